@@ -2,6 +2,7 @@
 
 CREATE SCHEMA IF NOT EXISTS redo AUTHORIZATION "pdbAdmin";
 
+-- DROP TABLE IF EXISTS redo.run;
 -- DROP TABLE IF EXISTS redo.token;
 -- DROP TABLE IF EXISTS redo.update_request;
 -- DROP TABLE IF EXISTS redo.user;
@@ -50,6 +51,26 @@ CREATE TABLE IF NOT EXISTS redo.update_request (
 	UNIQUE(pdb_id, user_id)
 );
 
+CREATE TABLE IF NOT EXISTS redo.run (
+	id bigint not null,
+	user_id bigint references redo.user on delete cascade deferrable initially deferred,
+	status varchar not null default 'registered',
+	has_image boolean not null default false,
+	created timestamp with time zone default CURRENT_TIMESTAMP not null,
+	started timestamp with time zone,
+	running timestamp with time zone,
+	ended timestamp with time zone,
+	modified timestamp with time zone default CURRENT_TIMESTAMP not null,
+	input jsonb,
+	score jsonb,
+	size bigint not null default 0,
+	rank integer,
+	primary key (user_id, id)
+);
+
+CREATE INDEX IF NOT EXISTS run_status_idx ON redo.run (status, created);
+CREATE INDEX IF NOT EXISTS run_created_idx ON redo.run (created DESC);
+
 ALTER TABLE
 	redo.user OWNER TO "pdbAdmin";
 
@@ -58,3 +79,6 @@ ALTER TABLE
 
 ALTER TABLE
 	redo.update_request OWNER TO "pdbAdmin";
+
+ALTER TABLE
+	redo.run OWNER TO "pdbAdmin";
@@ -25,6 +25,10 @@
  */
 
 #include "api-controller.hpp"
+#include "json-writer.hpp"
+
+#include <algorithm>
+#include <map>
 
 #include <zeep/crypto.hpp>
 #include <zeep/http/security.hpp>
@@ -37,19 +41,8 @@ using json = zeep::json::element;
 
 // --------------------------------------------------------------------
 
-JobInfo::JobInfo(const Run &run)
-	: id(run.id)
-	, status(run.status)
-	, date(run.date)
-	, started(run.started)
-	, score(run.score)
-	, input(run.input)
-{
-}
-
-// --------------------------------------------------------------------
-
 unsigned long thread_local APIRESTController_v2::s_token_id = 0;
+std::string thread_local APIRESTController_v2::s_accept;
 
 
 APIRESTController_v2::APIRESTController_v2()
@@ -60,22 +53,46 @@ APIRESTController_v2::APIRESTController_v2()
 
 	// Submit a run (job)
 	map_post_request("run", &APIRESTController_v2::createJob,
-		"mtz-file", "pdb-file", "restraints-file", "sequence-file", "parameters");
+		"mtz-file", "pdb-file", "restraints-file", "sequence-file", "parameters",
+		"mtz-upload", "pdb-upload", "restraints-upload", "sequence-upload");
+
+	// Submit a series of runs sharing the same input
+	map_post_request("run/batch", &APIRESTController_v2::createBatch,
+		"mtz-file", "pdb-file", "restraints-file", "sequence-file", "runs");
 
 	// return info for a run
 	map_get_request("run/{run}", &APIRESTController_v2::getRun, "run");
 
+	// resumable uploads
+	map_post_request("upload", &APIRESTController_v2::createUpload, "filename", "size");
+	map_get_request("upload/{id}", &APIRESTController_v2::getUpload, "id");
+	map_put_request("upload/{id}", &APIRESTController_v2::putUploadChunk, "id", "offset", "sha256", "chunk");
+	map_post_request("upload/{id}/finalize", &APIRESTController_v2::finalizeUpload, "id");
+	map_delete_request("upload/{id}", &APIRESTController_v2::deleteUpload, "id");
+
 	// get a list of the files in output
 	map_get_request("run/{run}/output", &APIRESTController_v2::getResultFileList, "run");
 
+	// get the part of the log starting at offset, optionally waiting for more
+	map_get_request("run/{run}/log", &APIRESTController_v2::getLog, "run", "offset", "wait");
+
 	// get all results file zipped into an archive
-	map_get_request("run/{run}/output/zipped", &APIRESTController_v2::getZippedResultFile, "run");
+	map_get_request("run/{run}/output/zipped", &APIRESTController_v2::getZippedResultFile, "run", "include", "exclude", "format");
 
 	// get a result file
 	map_get_request("run/{run}/output/{file}", &APIRESTController_v2::getResultFile, "run", "file");
 
+	// get a signed URL to download a result file, or the zip, without authentication
+	map_get_request("run/{run}/output/{file}/url", &APIRESTController_v2::getSignedURL, "run", "file", "valid");
+
 	// delete a run
 	map_delete_request("run/{run}", &APIRESTController_v2::deleteRun, "run");
+
+	// get the results of several runs in one archive
+	map_post_request("runs/zipped", &APIRESTController_v2::getZippedRuns, "ids", "include", "exclude", "format");
+
+	// the state of the admission queue
+	map_get_request("queue", &APIRESTController_v2::getQueueState);
 }
 
 bool APIRESTController_v2::handle_request(zh::request &req, zh::reply &rep)
@@ -180,6 +197,7 @@ bool APIRESTController_v2::handle_request(zh::request &req, zh::reply &rep)
 				throw zh::unauthorized_exception();
 			
 			s_token_id = stoi(credentials[0]);
+			s_accept = req.get_header("Accept");
 
 			result = zh::rest_controller::handle_request(req, rep);
 		}
@@ -196,6 +214,7 @@ bool APIRESTController_v2::handle_request(zh::request &req, zh::reply &rep)
 
 	// reset, just in case
 	s_token_id = 0;
+	s_accept.clear();
 
 	return result;
 }
@@ -212,23 +231,103 @@ bool APIRESTController_v2::handle_request(zh::request &req, zh::reply &rep)
 // 	TokenService::instance().deleteToken(s_token_id);
 // }
 
-std::vector<JobInfo> APIRESTController_v2::getAllRuns()
+zh::reply APIRESTController_v2::getAllRuns()
 {
 	auto token = getTokenForRequest();
 
-	std::vector<JobInfo> result;
+	std::vector<JobInfo> runs;
 	for (auto &run : RunService::instance().getRunsForUser(token.user))
-		result.emplace_back(run);
+		runs.emplace_back(run);
 
-	return result;
+	zh::reply rep{ zh::ok };
+	rep.set_content(toJSON(runs), "application/json");
+	return rep;
 }
 
 JobInfo APIRESTController_v2::createJob(const zh::file_param &diffractionData, const zh::file_param &coordinates,
-	const zh::file_param &restraints, const zh::file_param &sequence, const json &params)
+	const zh::file_param &restraints, const zh::file_param &sequence, const json &params,
+	const std::optional<std::string> &diffractionDataUpload, const std::optional<std::string> &coordinatesUpload,
+	const std::optional<std::string> &restraintsUpload, const std::optional<std::string> &sequenceUpload)
 {
 	auto token = getTokenForRequest();
 
-	return RunService::instance().submit(token.user, coordinates, diffractionData, restraints, sequence, params);
+	// Finalized uploads can be used instead of the file data
+	auto &uploadService = UploadService::instance();
+
+	std::map<std::string, fs::path> uploads;
+	std::vector<std::string> uploadIDs;
+
+	for (auto &&[type, id] : { std::make_tuple("MTZ", diffractionDataUpload), std::make_tuple("PDB", coordinatesUpload),
+			 std::make_tuple("CIF", restraintsUpload), std::make_tuple("SEQ", sequenceUpload) })
+	{
+		if (not id.has_value())
+			continue;
+
+		uploads[type] = uploadService.getFile(token.user, *id);
+		uploadIDs.push_back(*id);
+	}
+
+	auto run = RunService::instance().submit(token.user, coordinates, diffractionData, restraints, sequence, params, uploads);
+
+	for (auto &id : uploadIDs)
+		uploadService.remove(token.user, id);
+
+	return run;
+}
+
+UploadInfo APIRESTController_v2::createUpload(const std::string &filename, std::optional<std::uintmax_t> size)
+{
+	auto token = getTokenForRequest();
+	return UploadService::instance().create(token.user, filename, size);
+}
+
+UploadInfo APIRESTController_v2::getUpload(const std::string &id)
+{
+	auto token = getTokenForRequest();
+	return UploadService::instance().get(token.user, id);
+}
+
+UploadInfo APIRESTController_v2::putUploadChunk(const std::string &id, std::uintmax_t offset, const std::optional<std::string> &sha256, const zh::file_param &chunk)
+{
+	auto token = getTokenForRequest();
+	return UploadService::instance().putChunk(token.user, id, offset, chunk, sha256.value_or(""));
+}
+
+UploadInfo APIRESTController_v2::finalizeUpload(const std::string &id)
+{
+	auto token = getTokenForRequest();
+	return UploadService::instance().finalize(token.user, id);
+}
+
+void APIRESTController_v2::deleteUpload(const std::string &id)
+{
+	auto token = getTokenForRequest();
+	UploadService::instance().remove(token.user, id);
+}
+
+// Only show the totals and the entry for the user owning the token
+QueueState APIRESTController_v2::getQueueState()
+{
+	auto token = getTokenForRequest();
+
+	auto result = RunService::instance().getQueueState();
+
+	result.users.erase(std::remove_if(result.users.begin(), result.users.end(),
+		[user = token.user](const QueuedUser &qu) { return qu.user != user; }), result.users.end());
+
+	return result;
+}
+
+std::vector<JobInfo> APIRESTController_v2::createBatch(const zh::file_param &diffractionData, const zh::file_param &coordinates,
+	const std::vector<zh::file_param> &restraints, const std::vector<zh::file_param> &sequences, const json &runs)
+{
+	auto token = getTokenForRequest();
+
+	std::vector<JobInfo> result;
+	for (auto &run : RunService::instance().submitBatch(token.user, coordinates, diffractionData, restraints, sequences, runs))
+		result.emplace_back(run);
+
+	return result;
 }
 
 JobInfo APIRESTController_v2::getRun(unsigned long runID)
@@ -238,6 +337,13 @@ JobInfo APIRESTController_v2::getRun(unsigned long runID)
 	return RunService::instance().getRun(token.user, runID);
 }
 
+LogChunk APIRESTController_v2::getLog(unsigned long runID, std::optional<std::uintmax_t> offset, std::optional<int> wait)
+{
+	auto token = getTokenForRequest();
+
+	return RunService::instance().getRun(token.user, runID).getLog(offset.value_or(0), std::chrono::seconds(wait.value_or(0)));
+}
+
 std::vector<std::string> APIRESTController_v2::getResultFileList(unsigned long runID)
 {
 	auto token = getTokenForRequest();
@@ -252,14 +358,44 @@ fs::path APIRESTController_v2::getResultFile(unsigned long runID, const std::str
 	return RunService::instance().getRun(token.user, runID).getResultFile(file);
 }
 
-zh::reply APIRESTController_v2::getZippedResultFile(unsigned long runID)
+SignedURL APIRESTController_v2::getSignedURL(unsigned long runID, const std::string &file, std::optional<long> valid)
+{
+	auto token = getTokenForRequest();
+
+	auto run = RunService::instance().getRun(token.user, runID);
+	if (file != "zipped" and not fs::exists(run.getResultFile(file)))
+		throw std::runtime_error("File does not exist");
+
+	return SignedURLService::instance().sign(token.user, runID, file, std::chrono::seconds(valid.value_or(3600)));
+}
+
+zh::reply APIRESTController_v2::getZippedResultFile(unsigned long runID,
+	const std::optional<std::string> &include, const std::optional<std::string> &exclude,
+	const std::optional<std::string> &format)
+{
+	auto token = getTokenForRequest();
+	auto archiveFormat = selectArchiveFormat(format, s_accept);
+
+	const auto &[is, name] = RunService::instance().getRun(token.user, runID).getZippedResultFile({ include, exclude }, archiveFormat);
+
+	zh::reply rep{ zh::ok };
+	rep.set_content(is, archiveContentType(archiveFormat));
+	rep.set_header("content-disposition", "attachement; filename = \"" + name + '"');
+
+	return rep;
+}
+
+zh::reply APIRESTController_v2::getZippedRuns(const std::vector<unsigned long> &runIDs,
+	const std::optional<std::string> &include, const std::optional<std::string> &exclude,
+	const std::optional<std::string> &format)
 {
 	auto token = getTokenForRequest();
+	auto archiveFormat = selectArchiveFormat(format, s_accept);
 
-	const auto &[is, name] = RunService::instance().getRun(token.user, runID).getZippedResultFile();
+	const auto &[is, name] = RunService::instance().getZippedRuns(token.user, runIDs, { include, exclude }, archiveFormat);
 
 	zh::reply rep{ zh::ok };
-	rep.set_content(is, "application/zip");
+	rep.set_content(is, archiveContentType(archiveFormat));
 	rep.set_header("content-disposition", "attachement; filename = \"" + name + '"');
 
 	return rep;
@@ -326,7 +462,7 @@ void APIRESTController_v1::deleteToken(unsigned long id)
 	TokenService::instance().deleteToken(s_token_id);
 }
 
-std::vector<JobInfo> APIRESTController_v1::getAllRuns(unsigned long id)
+zh::reply APIRESTController_v1::getAllRuns(unsigned long id)
 {
 	checkTokenID(id);
 	return APIRESTController_v2::getAllRuns();
@@ -336,7 +472,7 @@ JobInfo APIRESTController_v1::createJob(unsigned long tokenID, const zh::file_pa
 	const zh::file_param &restraints, const zh::file_param &sequence, const json &params)
 {
 	checkTokenID(tokenID);
-	return APIRESTController_v2::createJob(diffractionData, coordinates, restraints, sequence, params);
+	return APIRESTController_v2::createJob(diffractionData, coordinates, restraints, sequence, params, {}, {}, {}, {});
 }
 
 JobInfo APIRESTController_v1::getRun(unsigned long tokenID, unsigned long runID)
@@ -360,7 +496,7 @@ fs::path APIRESTController_v1::getResultFile(unsigned long tokenID, unsigned lon
 zh::reply APIRESTController_v1::getZippedResultFile(unsigned long tokenID, unsigned long runID)
 {
 	checkTokenID(tokenID);
-	return APIRESTController_v2::getZippedResultFile(runID);
+	return APIRESTController_v2::getZippedResultFile(runID, {}, {}, {});
 }
 
 void APIRESTController_v1::deleteRun(unsigned long tokenID, unsigned long runID)
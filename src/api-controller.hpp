@@ -27,7 +27,9 @@
 #pragma once
 
 #include "run-service.hpp"
+#include "signed-url.hpp"
 #include "token-service.hpp"
+#include "upload-service.hpp"
 
 #include <zeep/http/rest-controller.hpp>
 
@@ -41,8 +43,22 @@ struct JobInfo
 	std::optional<std::chrono::time_point<std::chrono::system_clock>> started;
 	std::optional<Score> score;
 	std::vector<std::string> input;
-
-	JobInfo(const Run &run);
+	std::optional<int> rank;
+	std::optional<std::chrono::time_point<std::chrono::system_clock>> estimatedStart;
+	std::optional<std::chrono::time_point<std::chrono::system_clock>> estimatedEnd;
+
+	JobInfo(const Run &run)
+		: id(run.id)
+		, status(run.status)
+		, date(run.date)
+		, started(run.started)
+		, score(run.score)
+		, input(run.input)
+		, rank(run.rank)
+		, estimatedStart(run.estimatedStart)
+		, estimatedEnd(run.estimatedEnd)
+	{
+	}
 
 	template<typename Archive>
 	void serialize(Archive& ar, unsigned long version)
@@ -52,7 +68,10 @@ struct JobInfo
 		   & zeep::make_nvp("date", date)
 		   & zeep::make_nvp("started-date", started)
 		   & zeep::make_nvp("score", score)
-		   & zeep::make_nvp("input", input);
+		   & zeep::make_nvp("input", input)
+		   & zeep::make_nvp("rank", rank)
+		   & zeep::make_nvp("estimated-start", estimatedStart)
+		   & zeep::make_nvp("estimated-end", estimatedEnd);
 	}
 };
 
@@ -65,22 +84,47 @@ class APIRESTController_v2 : public zeep::http::rest_controller
 	// Bottle neck, to validate access tokens on requests
 	virtual bool handle_request(zeep::http::request &req, zeep::http::reply &rep);
 
-	// CRUD routines
-	std::vector<JobInfo> getAllRuns();
+	// CRUD routines, the list of runs is written as JSON directly
+	zeep::http::reply getAllRuns();
 
 	JobInfo createJob(const zeep::http::file_param &diffractionData, const zeep::http::file_param &coordinates,
-		const zeep::http::file_param &restraints, const zeep::http::file_param &sequence, const zeep::json::element &params);
+		const zeep::http::file_param &restraints, const zeep::http::file_param &sequence, const zeep::json::element &params,
+		const std::optional<std::string> &diffractionDataUpload, const std::optional<std::string> &coordinatesUpload,
+		const std::optional<std::string> &restraintsUpload, const std::optional<std::string> &sequenceUpload);
+
+	std::vector<JobInfo> createBatch(const zeep::http::file_param &diffractionData, const zeep::http::file_param &coordinates,
+		const std::vector<zeep::http::file_param> &restraints, const std::vector<zeep::http::file_param> &sequences,
+		const zeep::json::element &runs);
 
 	JobInfo getRun(unsigned long runID);
 
 	std::vector<std::string> getResultFileList(unsigned long runID);
 
+	LogChunk getLog(unsigned long runID, std::optional<std::uintmax_t> offset, std::optional<int> wait);
+
 	std::filesystem::path getResultFile(unsigned long runID, const std::string &file);
 
-	zeep::http::reply getZippedResultFile(unsigned long runID);
+	zeep::http::reply getZippedResultFile(unsigned long runID,
+		const std::optional<std::string> &include, const std::optional<std::string> &exclude,
+		const std::optional<std::string> &format);
+	zeep::http::reply getZippedRuns(const std::vector<unsigned long> &runIDs,
+		const std::optional<std::string> &include, const std::optional<std::string> &exclude,
+		const std::optional<std::string> &format);
+
+	SignedURL getSignedURL(unsigned long runID, const std::string &file, std::optional<long> valid);
 
 	void deleteRun(unsigned long runID);
 
+	QueueState getQueueState();
+
+	// Resumable uploads
+	UploadInfo createUpload(const std::string &filename, std::optional<std::uintmax_t> size);
+	UploadInfo getUpload(const std::string &id);
+	UploadInfo putUploadChunk(const std::string &id, std::uintmax_t offset, const std::optional<std::string> &sha256,
+		const zeep::http::file_param &chunk);
+	UploadInfo finalizeUpload(const std::string &id);
+	void deleteUpload(const std::string &id);
+
   protected:
 
 	Token getTokenForRequest() const
@@ -90,6 +134,9 @@ class APIRESTController_v2 : public zeep::http::rest_controller
 
 	std::filesystem::path m_pdb_redo_dir;
 	static thread_local unsigned long s_token_id;
+
+	// The accept header of the current request, used to select an archive format
+	static thread_local std::string s_accept;
 };
 
 class APIRESTController_v1 : public APIRESTController_v2
@@ -99,7 +146,7 @@ class APIRESTController_v1 : public APIRESTController_v2
 
 	Token getToken(unsigned long id);
 	void deleteToken(unsigned long id);
-	std::vector<JobInfo> getAllRuns(unsigned long id);
+	zeep::http::reply getAllRuns(unsigned long id);
 
 	JobInfo createJob(unsigned long tokenID, const zeep::http::file_param &diffractionData, const zeep::http::file_param &coordinates,
 		const zeep::http::file_param &restraints, const zeep::http::file_param &sequence, const zeep::json::element &params);
@@ -26,6 +26,7 @@
 
 #include "data-service.hpp"
 
+#include "entry-index.hpp"
 #include "https-client.hpp"
 #include "zip-support.hpp"
 #include "prsm-db-connection.hpp"
@@ -36,6 +37,8 @@
 
 #include <charconv>
 #include <iostream>
+#include <regex>
+#include <thread>
 
 namespace fs = std::filesystem;
 
@@ -67,17 +70,69 @@ DataService::DataService()
 		throw std::runtime_error("PDB-REDO data directory (" + m_data_dir.string() + ") does not exists");
 }
 
-UpdateStatus DataService::getUpdateStatus(const std::string &pdbID)
+DataService::~DataService()
 {
-	UpdateStatus status;
+	{
+		std::lock_guard lock(m_readers_m);
+		m_done = true;
+		m_readers_cv.notify_all();
+	}
+
+	for (auto &t : m_readers)
+		t.join();
+}
+
+// The reader threads are started when first needed, i.e. after the
+// server process has forked
+std::future<void> DataService::schedule(std::function<void()> task)
+{
+	std::packaged_task<void()> pt(std::move(task));
+	auto result = pt.get_future();
 
-	auto data = getData(pdbID);
-	if (data and data["properties"])
+	std::lock_guard lock(m_readers_m);
+
+	if (m_readers.empty())
 	{
-		auto v = data["properties"]["VERSION"].as<float>();
-		status.ok = v >= version();
+		std::size_t n = std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1U), kMaxReaders);
+		for (std::size_t i = 0; i < n; ++i)
+			m_readers.emplace_back(&DataService::runReader, this);
 	}
 
+	m_tasks.push_back(std::move(pt));
+	m_readers_cv.notify_one();
+
+	return result;
+}
+
+void DataService::runReader()
+{
+	for (;;)
+	{
+		std::packaged_task<void()> task;
+
+		{
+			std::unique_lock lock(m_readers_m);
+			m_readers_cv.wait(lock, [this]
+				{ return m_done or not m_tasks.empty(); });
+
+			if (m_done)
+				break;
+
+			task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+		}
+
+		task();
+	}
+}
+
+UpdateStatus DataService::getUpdateStatus(const std::string &pdbID, std::optional<float> entryVersion)
+{
+	UpdateStatus status;
+
+	if (entryVersion)
+		status.ok = *entryVersion >= version();
+
 	pqxx::transaction tx(prsm_db_connection::instance());
 	auto r = tx.exec1(R"(SELECT MAX(version) FROM redo.update_request WHERE pdb_id = )" + tx.quote(pdbID));
 	tx.commit();
@@ -288,7 +343,8 @@ zeep::json::element DataService::getData(const std::string &pdbID, const std::op
 	return data;
 }
 
-std::tuple<std::istream *, std::string> DataService::getZipFile(const std::string &pdbID, const std::optional<std::string> attic)
+std::tuple<std::istream *, std::string> DataService::getZipFile(const std::string &pdbID, const std::optional<std::string> attic,
+	const FileSelection &selection, ArchiveFormat format)
 {
 	auto entry_dir = m_data_dir / pdbID.substr(1, 2) / pdbID;
 	if (attic)
@@ -297,7 +353,7 @@ std::tuple<std::istream *, std::string> DataService::getZipFile(const std::strin
 	if (not fs::exists(entry_dir))
 		throw zeep::http::not_found;
 
-	ZipWriter zw;
+	std::unique_ptr<ArchiveStream> zs(new ArchiveStream(format));
 
 	fs::path d(pdbID);
 
@@ -307,7 +363,11 @@ std::tuple<std::istream *, std::string> DataService::getZipFile(const std::strin
 			continue;
 		
 		if (f.is_regular_file())
-			zw.add(f.path(), (d / fs::relative(f.path(), entry_dir)).string());
+		{
+			auto rel = fs::relative(f.path(), entry_dir);
+			if (selection(rel))
+				zs->add(f.path(), d / rel);
+		}
 		else if (f.is_directory())
 		{
 			for (auto fr : fs::directory_iterator(f.path()))
@@ -315,11 +375,190 @@ std::tuple<std::istream *, std::string> DataService::getZipFile(const std::strin
 				if (not fr.is_regular_file())
 					continue;
 				
-				zw.add(fr.path(), (d / fs::relative(fr.path(), entry_dir)).string());
+				auto rel = fs::relative(fr.path(), entry_dir);
+				if (selection(rel))
+					zs->add(fr.path(), d / rel);
+			}
+		}
+	}
+
+	if (zs->empty())
+		throw zeep::http::not_found;
+
+	return { zs.release(), pdbID + archiveExtension(format) };
+}
+
+
+// --------------------------------------------------------------------
+
+// A property value from a data.json file, as the entry index would return
+// it. This way the result does not depend on whether an entry was up to
+// date in the index. Without an index only plain values are returned.
+static zeep::json::element summaryValue(const EntryIndexFile *index, const std::string &name, const zeep::json::element &value)
+{
+	zeep::json::element result;
+
+	if (index == nullptr)
+	{
+		if (name.length() < EntryIndexFile::kNameLength and (value.is_number() or value.is_boolean() or value.is_string()))
+			result = value;
+	}
+	else if (auto column = index->getColumn(name); column != nullptr)
+	{
+		switch (column->type)
+		{
+			case EntryColumnType::NUMBER:
+				if (value.is_number())
+					result = value.as<double>();
+				else if (value.is_boolean())
+					result = value.as<bool>() ? 1.0 : 0.0;
+				break;
+
+			case EntryColumnType::BOOLEAN:
+				if (value.is_boolean())
+					result = value;
+				break;
+
+			case EntryColumnType::STRING:
+				if (value.is_string())
+					result = value;
+				break;
+		}
+	}
+
+	return result;
+}
+
+zeep::json::element DataService::getSummaries(const std::vector<std::string> &pdbIDs, const std::vector<std::string> &fields)
+{
+	const std::regex kEntryRx(R"([0-9][0-9a-z]{3,7})");
+
+	if (pdbIDs.empty() or pdbIDs.size() > kMaxSummaryCount)
+		throw zeep::http::bad_request;
+
+	std::shared_ptr<const EntryIndexFile> index;
+	try
+	{
+		index = EntryIndex::instance().getFile();
+	}
+	catch (const std::exception &)
+	{
+		// no index yet, read everything
+	}
+
+	std::vector<zeep::json::element> summaries(pdbIDs.size());
+	std::vector<std::size_t> uncached;
+
+	for (std::size_t i = 0; i < pdbIDs.size(); ++i)
+	{
+		auto pdbID = pdbIDs[i];
+		zeep::to_lower(pdbID);
+
+		auto &summary = summaries[i];
+		summary["pdb-id"] = pdbID;
+		summary["available"] = false;
+
+		if (not std::regex_match(pdbID, kEntryRx))
+			continue;
+
+		auto file = m_data_dir / pdbID.substr(1, 2) / pdbID / "data.json";
+
+		std::error_code ec;
+		auto mtime = EntryIndex::getModificationTime(file, ec);
+		if (ec)
+			continue;
+
+		summary["available"] = true;
+
+		auto row = index ? index->find(pdbID) : 0;
+		if (not index or row == index->size() or index->getMTime(row) != mtime)
+		{
+			uncached.push_back(i);
+			continue;
+		}
+
+		auto &properties = summary["properties"];
+
+		if (fields.empty())
+		{
+			for (auto &column : index->getColumns())
+			{
+				if (not column.isNull(row))
+					properties[column.name] = column.value(row);
+			}
+		}
+		else
+		{
+			for (auto &field : fields)
+			{
+				auto column = index->getColumn(field);
+				properties[field] = column ? column->value(row) : zeep::json::element();
 			}
 		}
 	}
 
-	return { zw.finish(), pdbID + ".zip" };
+	// Read the data.json files of the entries missing from the index on
+	// the shared reader threads
+
+	std::vector<std::future<void>> reads;
+
+	for (auto ix : uncached)
+	{
+		reads.push_back(schedule([this, &summary = summaries[ix], &fields, index = index.get()]()
+			{
+				try
+				{
+					auto data = getData(summary["pdb-id"].as<std::string>());
+					auto &source = data["properties"];
+
+					auto &properties = summary["properties"];
+
+					if (fields.empty())
+					{
+						for (auto p = source.begin(); p != source.end(); ++p)
+						{
+							auto value = summaryValue(index, p.key(), p.value());
+							if (not value.is_null())
+								properties[p.key()] = std::move(value);
+						}
+					}
+					else
+					{
+						for (auto &field : fields)
+							properties[field] = summaryValue(index, field, source[field]);
+					}
+				}
+				catch (const std::exception &e)
+				{
+					std::cerr << e.what() << std::endl;
+					summary["available"] = false;
+				}
+			}));
+	}
+
+	for (auto &read : reads)
+		read.wait();
+
+	zeep::json::element result{
+		{ "version", version() }
+	};
+
+	auto &entries = result["entries"];
+	for (auto &summary : summaries)
+		entries.push_back(std::move(summary));
+
+	return result;
 }
 
+zeep::json::element DataService::getProperties(const std::string &pdbID, const std::vector<std::string> &fields)
+{
+	auto summaries = getSummaries({ pdbID }, fields);
+
+	for (auto &summary : summaries["entries"])
+	{
+		if (summary["available"].as<bool>())
+			return std::move(summary["properties"]);
+	}
+
+	return {};
+}
@@ -27,11 +27,18 @@
 #pragma once
 
 #include "user-service.hpp"
+#include "zip-support.hpp"
 
 #include <zeep/json/element.hpp>
 
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 struct UpdateRequest
@@ -58,7 +65,7 @@ struct UpdateRequest
 
 struct UpdateStatus
 {
-	bool ok;
+	bool ok = false;
 	std::optional<float> pendingVersion;
 
 	explicit operator bool() { return ok; }
@@ -76,7 +83,8 @@ class DataService
   public:
 	static DataService &instance();
 
-	UpdateStatus getUpdateStatus(const std::string &pdbID);
+	// The update status of an entry, entryVersion is the VERSION in its data.json
+	UpdateStatus getUpdateStatus(const std::string &pdbID, std::optional<float> entryVersion);
 	void requestUpdate(const std::string &pdbID, const User &user);
 	void deleteUpdateRequest(int id);
 
@@ -92,17 +100,43 @@ class DataService
 
 	std::vector<std::string> getFileList(const std::string &pdbID, const std::optional<std::string> attic = {});
 	std::filesystem::path getFile(const std::string &pdbID, const std::string &file, const std::optional<std::string> attic = {});
-	std::tuple<std::istream *, std::string> getZipFile(const std::string &pdbID, const std::optional<std::string> attic = {});
+	std::tuple<std::istream *, std::string> getZipFile(const std::string &pdbID, const std::optional<std::string> attic = {},
+		const FileSelection &selection = {}, ArchiveFormat format = ArchiveFormat::ZIP);
 	zeep::json::element getData(const std::string &pdbID, const std::optional<std::string> attic = {});
 
+	// The properties in fields, all when empty, of many entries at once. Taken
+	// from the entry index when it is up to date for an entry, the data.json
+	// files of the other entries are read in parallel.
+	zeep::json::element getSummaries(const std::vector<std::string> &pdbIDs, const std::vector<std::string> &fields);
+
+	// The properties in fields of a single entry, taken from the entry
+	// index like those of getSummaries. Null when there is no such entry.
+	zeep::json::element getProperties(const std::string &pdbID, const std::vector<std::string> &fields);
+
+	static constexpr std::size_t kMaxSummaryCount = 1000;
+
   private:
 	DataService();
+	~DataService();
 
 	DataService(const DataService &) = delete;
 	DataService &operator=(const DataService &) = delete;
 
 	void checkUpdateRequests();
 
+	// Run task on one of the reader threads, these are shared by all
+	// requests so the number of files read at the same time is limited
+	std::future<void> schedule(std::function<void()> task);
+	void runReader();
+
 	std::filesystem::path m_data_dir;
 	std::mutex m_mutex;
+
+	static constexpr std::size_t kMaxReaders = 8;
+
+	std::mutex m_readers_m;
+	std::condition_variable m_readers_cv;
+	std::deque<std::packaged_task<void()>> m_tasks;
+	std::vector<std::thread> m_readers;
+	bool m_done = false;
 };
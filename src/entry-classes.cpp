@@ -0,0 +1,136 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "entry-classes.hpp"
+
+namespace
+{
+
+using json = zeep::json::element;
+
+// For RMS Z-scores, where values above one are a problem
+std::string zScoreClass(const json &o, const json &f)
+{
+	if (not o.is_number() or not f.is_number())
+		return {};
+
+	auto ov = o.as<double>();
+	auto fv = f.as<double>();
+
+	if (ov > 1.0)
+	{
+		if (fv < ov)
+			return "better";
+		if (fv > ov)
+			return "worse";
+	}
+	else if (fv > 1.0)
+		return "worse";
+
+	return {};
+}
+
+// For percentiles, where higher is better
+std::string percentileClass(std::optional<double> o, std::optional<double> f)
+{
+	if (not o or not f)
+		return {};
+
+	if (*f == 100 or *f > *o)
+		return "better";
+	if (*f < *o)
+		return "worse";
+
+	return {};
+}
+
+std::optional<double> number(const json &v)
+{
+	std::optional<double> result;
+	if (v.is_number())
+		result = v.as<double>();
+	return result;
+}
+
+std::string percentileClass(const json &o, const json &f)
+{
+	return percentileClass(number(o), number(f));
+}
+
+// The final R-free compared to the expected range of the calculated one
+std::string rffinClass(const json &data)
+{
+	if (not data["RFFIN"].is_number() or not data["SIGRFCAL"].is_number())
+		return {};
+
+	auto rffin = data["RFFIN"].as<double>();
+	auto sigrfcal = data["SIGRFCAL"].as<double>();
+
+	std::optional<double> rfcal;
+
+	if (data["RFREE"].is_null() or data["ZCALERR"] == true or data["TSTCNT"] != data["NTSTCNT"])
+		rfcal = number(data["RFCALUNB"]);
+	else
+		rfcal = number(data["RFCAL"]);
+
+	if (rfcal)
+	{
+		if (rffin < (*rfcal - 2.6 * sigrfcal))
+			return "better";
+		if (rffin > (*rfcal + 2.6 * sigrfcal))
+			return "worse";
+	}
+
+	return {};
+}
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+EntryClasses EntryClasses::create(const json &data, const std::optional<StatsPercentiles> &percentiles)
+{
+	EntryClasses result;
+
+	result.RFFIN = rffinClass(data);
+
+	if (percentiles)
+		result.RFFIN_PERCENTILE = percentileClass(percentiles->RFREE, percentiles->RFFIN);
+
+	result.FBRMSZ = zScoreClass(data["OBRMSZ"], data["FBRMSZ"]);
+	result.FARMSZ = zScoreClass(data["OARMSZ"], data["FARMSZ"]);
+
+	result.TFZRAMA = percentileClass(data["TOZRAMA"], data["TFZRAMA"]);
+	result.TFCHI12 = percentileClass(data["TOCHI12"], data["TFCHI12"]);
+	result.TFZPAK1 = percentileClass(data["TOZPAK1"], data["TFZPAK1"]);
+	result.TFZPAK2 = percentileClass(data["TOZPAK2"], data["TFZPAK2"]);
+	result.TFCONFAL = percentileClass(data["TOCONFAL"], data["TFCONFAL"]);
+	result.TFBPGRMSZ = percentileClass(data["TOBPGRMSZ"], data["TFBPGRMSZ"]);
+	result.TFWBMPS = percentileClass(data["TOWBMPS"], data["TFWBMPS"]);
+	result.TFHBSAT = percentileClass(data["TOHBSAT"], data["TFHBSAT"]);
+
+	return result;
+}
@@ -0,0 +1,66 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "stats-service.hpp"
+
+#include <zeep/json/element.hpp>
+#include <zeep/nvp.hpp>
+
+#include <optional>
+#include <string>
+
+// --------------------------------------------------------------------
+// Whether the final values shown in the entry tables are better or worse
+// than the original ones. Each member contains "better", "worse" or is
+// empty and is named after the final value in data.json it applies to.
+
+struct EntryClasses
+{
+	std::string RFFIN, RFFIN_PERCENTILE, FBRMSZ, FARMSZ;
+	std::string TFZRAMA, TFCHI12, TFZPAK1, TFZPAK2, TFCONFAL, TFBPGRMSZ, TFWBMPS, TFHBSAT;
+
+	// Classify the properties in data.json, percentiles are those of RFREE and RFFIN
+	static EntryClasses create(const zeep::json::element &properties, const std::optional<StatsPercentiles> &percentiles);
+
+	template <typename Archive>
+	void serialize(Archive &ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("RFFIN", RFFIN)
+		   & zeep::make_nvp("RFFIN-percentile", RFFIN_PERCENTILE)
+		   & zeep::make_nvp("FBRMSZ", FBRMSZ)
+		   & zeep::make_nvp("FARMSZ", FARMSZ)
+		   & zeep::make_nvp("TFZRAMA", TFZRAMA)
+		   & zeep::make_nvp("TFCHI12", TFCHI12)
+		   & zeep::make_nvp("TFZPAK1", TFZPAK1)
+		   & zeep::make_nvp("TFZPAK2", TFZPAK2)
+		   & zeep::make_nvp("TFCONFAL", TFCONFAL)
+		   & zeep::make_nvp("TFBPGRMSZ", TFBPGRMSZ)
+		   & zeep::make_nvp("TFWBMPS", TFWBMPS)
+		   & zeep::make_nvp("TFHBSAT", TFHBSAT);
+	}
+};
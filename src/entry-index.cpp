@@ -0,0 +1,1225 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "entry-index.hpp"
+#include "prsm-db-connection.hpp"
+#include "rama-angles.hpp"
+
+#include <mcfp.hpp>
+
+#include <zeep/json/parser.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <regex>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+const char kIndexMagic[8] = { 'P', 'R', 'S', 'M', 'I', 'D', 'X', '1' };
+
+// The key for the advisory lock held by the process building the index
+const int64_t kEntryIndexLockKey = 0x7072736d66;
+
+const double kNaN = std::numeric_limits<double>::quiet_NaN();
+
+struct IndexHeader
+{
+	char magic[8];
+	uint64_t entryCount;
+	uint64_t columnCount;
+	uint64_t idsOffset;
+	uint64_t mtimesOffset;
+	uint64_t columnsOffset;
+	uint64_t fileSize;
+};
+
+struct IndexColumn
+{
+	char name[EntryIndexFile::kNameLength];
+	EntryColumnType type;
+	uint32_t reserved;
+	uint64_t dataOffset;
+	uint64_t stringCount;
+	uint64_t stringsOffset;
+};
+
+uint64_t align8(uint64_t offset)
+{
+	return (offset + 7) & ~uint64_t(7);
+}
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+bool EntryIndexFile::Column::isNull(std::size_t row) const
+{
+	return type == EntryColumnType::STRING ? strings[row] == UINT32_MAX : std::isnan(numbers[row]);
+}
+
+double EntryIndexFile::Column::number(std::size_t row) const
+{
+	return type == EntryColumnType::STRING ? kNaN : numbers[row];
+}
+
+std::string_view EntryIndexFile::Column::string(std::size_t row) const
+{
+	if (type != EntryColumnType::STRING or strings[row] == UINT32_MAX)
+		return {};
+
+	auto s = strings[row];
+	return { chars + offsets[s], offsets[s + 1] - offsets[s] };
+}
+
+zeep::json::element EntryIndexFile::Column::value(std::size_t row) const
+{
+	zeep::json::element result;
+
+	if (not isNull(row))
+	{
+		switch (type)
+		{
+			case EntryColumnType::NUMBER: result = numbers[row]; break;
+			case EntryColumnType::BOOLEAN: result = numbers[row] != 0; break;
+			case EntryColumnType::STRING: result = std::string(string(row)); break;
+		}
+	}
+
+	return result;
+}
+
+EntryIndexFile::EntryIndexFile(const fs::path &file)
+{
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("Could not open entry index " + file.string() + ": " + strerror(errno));
+
+	m_length = fs::file_size(file);
+
+	if (m_length >= sizeof(IndexHeader))
+		m_data = mmap(nullptr, m_length, PROT_READ, MAP_SHARED, fd, 0);
+
+	close(fd);
+
+	if (m_data == nullptr or m_data == MAP_FAILED)
+	{
+		m_data = nullptr;
+		throw std::runtime_error("Could not map entry index " + file.string());
+	}
+
+	auto base = static_cast<const char *>(m_data);
+	auto header = static_cast<const IndexHeader *>(m_data);
+
+	if (memcmp(header->magic, kIndexMagic, sizeof(kIndexMagic)) != 0 or header->fileSize != m_length)
+	{
+		munmap(m_data, m_length);
+		throw std::runtime_error("Invalid entry index " + file.string());
+	}
+
+	m_size = header->entryCount;
+	m_ids = base + header->idsOffset;
+	m_mtimes = reinterpret_cast<const int64_t *>(base + header->mtimesOffset);
+
+	auto columns = reinterpret_cast<const IndexColumn *>(base + header->columnsOffset);
+	for (std::size_t i = 0; i < header->columnCount; ++i)
+	{
+		auto &ic = columns[i];
+
+		Column c;
+		c.name.assign(ic.name, strnlen(ic.name, kNameLength));
+		c.type = ic.type;
+
+		if (ic.type == EntryColumnType::STRING)
+		{
+			c.strings = reinterpret_cast<const uint32_t *>(base + ic.dataOffset);
+			c.offsets = reinterpret_cast<const uint64_t *>(base + ic.stringsOffset);
+			c.chars = reinterpret_cast<const char *>(c.offsets + ic.stringCount + 1);
+			c.stringCount = ic.stringCount;
+		}
+		else
+			c.numbers = reinterpret_cast<const double *>(base + ic.dataOffset);
+
+		m_columns.emplace_back(std::move(c));
+	}
+}
+
+EntryIndexFile::~EntryIndexFile()
+{
+	if (m_data)
+		munmap(m_data, m_length);
+}
+
+std::string EntryIndexFile::getID(std::size_t row) const
+{
+	auto id = m_ids + row * kIDLength;
+	return { id, strnlen(id, kIDLength) };
+}
+
+int64_t EntryIndexFile::getMTime(std::size_t row) const
+{
+	return m_mtimes[row];
+}
+
+std::size_t EntryIndexFile::find(const std::string &pdbID) const
+{
+	std::size_t L = 0, R = m_size;
+
+	while (L < R)
+	{
+		auto i = (L + R) / 2;
+		if (getID(i) < pdbID)
+			L = i + 1;
+		else
+			R = i;
+	}
+
+	return L < m_size and getID(L) == pdbID ? L : m_size;
+}
+
+const EntryIndexFile::Column *EntryIndexFile::getColumn(const std::string &name) const
+{
+	for (auto &c : m_columns)
+	{
+		if (c.name == name)
+			return &c;
+	}
+
+	return nullptr;
+}
+
+// --------------------------------------------------------------------
+// The filter expressions, a small recursive descent parser producing a
+// tree that is evaluated for each row. Missing values are NaN, every
+// comparison with them is false so those rows are not selected.
+
+namespace
+{
+
+struct Value
+{
+	double number = kNaN;
+	std::string_view text;
+	bool isText = false;
+
+	bool truth() const
+	{
+		return not isText and not std::isnan(number) and number != 0;
+	}
+};
+
+struct Expr
+{
+	virtual ~Expr() = default;
+	virtual Value eval(std::size_t row) const = 0;
+};
+
+using ExprPtr = std::unique_ptr<Expr>;
+
+struct ConstantExpr : public Expr
+{
+	ConstantExpr(double number)
+	{
+		m_value.number = number;
+	}
+
+	ConstantExpr(std::string text)
+		: m_text(std::move(text))
+	{
+		m_value.text = m_text;
+		m_value.isText = true;
+	}
+
+	Value eval(std::size_t row) const override
+	{
+		return m_value;
+	}
+
+	std::string m_text;
+	Value m_value;
+};
+
+struct ColumnExpr : public Expr
+{
+	ColumnExpr(const EntryIndexFile::Column &column)
+		: m_column(column)
+	{
+	}
+
+	Value eval(std::size_t row) const override
+	{
+		Value result;
+
+		if (m_column.type == EntryColumnType::STRING)
+		{
+			if (not m_column.isNull(row))
+			{
+				result.text = m_column.string(row);
+				result.isText = true;
+			}
+		}
+		else
+			result.number = m_column.numbers[row];
+
+		return result;
+	}
+
+	const EntryIndexFile::Column &m_column;
+};
+
+struct UnaryExpr : public Expr
+{
+	UnaryExpr(char op, ExprPtr arg)
+		: m_op(op)
+		, m_arg(std::move(arg))
+	{
+	}
+
+	Value eval(std::size_t row) const override
+	{
+		auto v = m_arg->eval(row);
+
+		Value result;
+		if (not v.isText and not std::isnan(v.number))
+			result.number = m_op == '-' ? -v.number : not v.truth();
+
+		return result;
+	}
+
+	char m_op;
+	ExprPtr m_arg;
+};
+
+enum class BinaryOp
+{
+	ADD, SUB, MUL, DIV, LT, LE, GT, GE, EQ, NE, AND, OR
+};
+
+struct BinaryExpr : public Expr
+{
+	BinaryExpr(BinaryOp op, ExprPtr a, ExprPtr b)
+		: m_op(op)
+		, m_a(std::move(a))
+		, m_b(std::move(b))
+	{
+	}
+
+	Value eval(std::size_t row) const override
+	{
+		Value result;
+
+		auto a = m_a->eval(row);
+
+		// short cut the logical operators
+		if (m_op == BinaryOp::AND or m_op == BinaryOp::OR)
+		{
+			bool t = a.truth();
+			if (t == (m_op == BinaryOp::OR))
+				result.number = t;
+			else
+				result.number = m_b->eval(row).truth();
+			return result;
+		}
+
+		auto b = m_b->eval(row);
+
+		if (a.isText or b.isText)
+		{
+			if (a.isText and b.isText)
+			{
+				int c = a.text.compare(b.text);
+				switch (m_op)
+				{
+					case BinaryOp::LT: result.number = c < 0; break;
+					case BinaryOp::LE: result.number = c <= 0; break;
+					case BinaryOp::GT: result.number = c > 0; break;
+					case BinaryOp::GE: result.number = c >= 0; break;
+					case BinaryOp::EQ: result.number = c == 0; break;
+					case BinaryOp::NE: result.number = c != 0; break;
+					default: break;
+				}
+			}
+
+			return result;
+		}
+
+		if (std::isnan(a.number) or std::isnan(b.number))
+			return result;
+
+		switch (m_op)
+		{
+			case BinaryOp::ADD: result.number = a.number + b.number; break;
+			case BinaryOp::SUB: result.number = a.number - b.number; break;
+			case BinaryOp::MUL: result.number = a.number * b.number; break;
+			case BinaryOp::DIV: result.number = b.number != 0 ? a.number / b.number : kNaN; break;
+			case BinaryOp::LT: result.number = a.number < b.number; break;
+			case BinaryOp::LE: result.number = a.number <= b.number; break;
+			case BinaryOp::GT: result.number = a.number > b.number; break;
+			case BinaryOp::GE: result.number = a.number >= b.number; break;
+			case BinaryOp::EQ: result.number = a.number == b.number; break;
+			case BinaryOp::NE: result.number = a.number != b.number; break;
+			default: break;
+		}
+
+		return result;
+	}
+
+	BinaryOp m_op;
+	ExprPtr m_a, m_b;
+};
+
+class FilterParser
+{
+  public:
+	FilterParser(const EntryIndexFile &file, const std::string &text, std::vector<std::string> &columns)
+		: m_file(file)
+		, m_text(text)
+		, m_columns(columns)
+	{
+		next();
+	}
+
+	ExprPtr parse()
+	{
+		auto result = parseOr();
+		if (m_token != Token::END)
+			error("unexpected " + m_value);
+		return result;
+	}
+
+  private:
+	enum class Token
+	{
+		END, NUMBER, TEXT, IDENT, LPAREN, RPAREN, PLUS, MINUS, MUL, DIV, LT, LE, GT, GE, EQ, NE
+	};
+
+	[[noreturn]] void error(const std::string &msg)
+	{
+		throw std::runtime_error("Error in filter at position " + std::to_string(m_start) + ": " + msg);
+	}
+
+	// Nested expressions are parsed recursively and so is the resulting
+	// tree when it is evaluated. Limit the nesting and the number of
+	// operators to keep a filter from overflowing the stack.
+	static constexpr int kMaxDepth = 64, kMaxOperators = 1000;
+
+	struct Nesting
+	{
+		Nesting(FilterParser &parser)
+			: m_parser(parser)
+		{
+			if (++m_parser.m_depth > kMaxDepth)
+				m_parser.error("filter is nested too deeply");
+		}
+
+		~Nesting()
+		{
+			--m_parser.m_depth;
+		}
+
+		FilterParser &m_parser;
+	};
+
+	void countOperator()
+	{
+		if (++m_operators > kMaxOperators)
+			error("filter contains too many operators");
+	}
+
+	void next()
+	{
+		while (m_pos < m_text.length() and std::isspace(static_cast<unsigned char>(m_text[m_pos])))
+			++m_pos;
+
+		m_start = m_pos;
+		m_value.clear();
+
+		if (m_pos >= m_text.length())
+		{
+			m_token = Token::END;
+			m_value = "end of filter";
+			return;
+		}
+
+		char ch = m_text[m_pos++];
+		m_value = ch;
+
+		switch (ch)
+		{
+			case '(': m_token = Token::LPAREN; break;
+			case ')': m_token = Token::RPAREN; break;
+			case '+': m_token = Token::PLUS; break;
+			case '-': m_token = Token::MINUS; break;
+			case '*': m_token = Token::MUL; break;
+			case '/': m_token = Token::DIV; break;
+			case '<':
+			case '>':
+			case '=':
+			case '!':
+				if (m_pos < m_text.length() and m_text[m_pos] == '=')
+					m_value += m_text[m_pos++];
+				else if (ch == '!')
+					error("expected !=");
+
+				if (m_value == "<") m_token = Token::LT;
+				else if (m_value == "<=") m_token = Token::LE;
+				else if (m_value == ">") m_token = Token::GT;
+				else if (m_value == ">=") m_token = Token::GE;
+				else if (m_value == "!=") m_token = Token::NE;
+				else m_token = Token::EQ;
+				break;
+
+			case '\'':
+			case '"':
+			{
+				auto e = m_text.find(ch, m_pos);
+				if (e == std::string::npos)
+					error("unterminated string");
+				m_value = m_text.substr(m_pos, e - m_pos);
+				m_pos = e + 1;
+				m_token = Token::TEXT;
+				break;
+			}
+
+			default:
+				if (std::isdigit(static_cast<unsigned char>(ch)) or ch == '.')
+				{
+					char *end;
+					m_number = std::strtod(m_text.c_str() + m_start, &end);
+					if (end == m_text.c_str() + m_start)
+						error("invalid number");
+					m_pos = end - m_text.c_str();
+					m_token = Token::NUMBER;
+				}
+				else if (std::isalpha(static_cast<unsigned char>(ch)) or ch == '_')
+				{
+					while (m_pos < m_text.length() and (std::isalnum(static_cast<unsigned char>(m_text[m_pos])) or m_text[m_pos] == '_'))
+						m_value += m_text[m_pos++];
+					m_token = Token::IDENT;
+				}
+				else
+					error(std::string("unexpected character ") + ch);
+		}
+	}
+
+	ExprPtr parseOr()
+	{
+		Nesting nesting(*this);
+
+		auto result = parseAnd();
+		while (m_token == Token::IDENT and m_value == "or")
+		{
+			countOperator();
+			next();
+			result.reset(new BinaryExpr(BinaryOp::OR, std::move(result), parseAnd()));
+		}
+		return result;
+	}
+
+	ExprPtr parseAnd()
+	{
+		auto result = parseNot();
+		while (m_token == Token::IDENT and m_value == "and")
+		{
+			countOperator();
+			next();
+			result.reset(new BinaryExpr(BinaryOp::AND, std::move(result), parseNot()));
+		}
+		return result;
+	}
+
+	ExprPtr parseNot()
+	{
+		if (m_token == Token::IDENT and m_value == "not")
+		{
+			Nesting nesting(*this);
+			countOperator();
+			next();
+			return ExprPtr(new UnaryExpr('!', parseNot()));
+		}
+
+		return parseComparison();
+	}
+
+	ExprPtr parseComparison()
+	{
+		auto result = parseSum();
+
+		BinaryOp op;
+		switch (m_token)
+		{
+			case Token::LT: op = BinaryOp::LT; break;
+			case Token::LE: op = BinaryOp::LE; break;
+			case Token::GT: op = BinaryOp::GT; break;
+			case Token::GE: op = BinaryOp::GE; break;
+			case Token::EQ: op = BinaryOp::EQ; break;
+			case Token::NE: op = BinaryOp::NE; break;
+			default: return result;
+		}
+
+		countOperator();
+		next();
+		return ExprPtr(new BinaryExpr(op, std::move(result), parseSum()));
+	}
+
+	ExprPtr parseSum()
+	{
+		auto result = parseProduct();
+		while (m_token == Token::PLUS or m_token == Token::MINUS)
+		{
+			auto op = m_token == Token::PLUS ? BinaryOp::ADD : BinaryOp::SUB;
+			countOperator();
+			next();
+			result.reset(new BinaryExpr(op, std::move(result), parseProduct()));
+		}
+		return result;
+	}
+
+	ExprPtr parseProduct()
+	{
+		auto result = parseUnary();
+		while (m_token == Token::MUL or m_token == Token::DIV)
+		{
+			auto op = m_token == Token::MUL ? BinaryOp::MUL : BinaryOp::DIV;
+			countOperator();
+			next();
+			result.reset(new BinaryExpr(op, std::move(result), parseUnary()));
+		}
+		return result;
+	}
+
+	ExprPtr parseUnary()
+	{
+		if (m_token == Token::MINUS)
+		{
+			Nesting nesting(*this);
+			countOperator();
+			next();
+			return ExprPtr(new UnaryExpr('-', parseUnary()));
+		}
+
+		return parsePrimary();
+	}
+
+	ExprPtr parsePrimary()
+	{
+		ExprPtr result;
+
+		switch (m_token)
+		{
+			case Token::NUMBER:
+				result.reset(new ConstantExpr(m_number));
+				break;
+
+			case Token::TEXT:
+				result.reset(new ConstantExpr(m_value));
+				break;
+
+			case Token::IDENT:
+				if (m_value == "true" or m_value == "false")
+					result.reset(new ConstantExpr(m_value == "true" ? 1.0 : 0.0));
+				else
+				{
+					auto column = m_file.getColumn(m_value);
+					if (column == nullptr)
+						error("unknown column " + m_value);
+
+					if (std::find(m_columns.begin(), m_columns.end(), m_value) == m_columns.end())
+						m_columns.push_back(m_value);
+
+					result.reset(new ColumnExpr(*column));
+				}
+				break;
+
+			case Token::LPAREN:
+				next();
+				result = parseOr();
+				if (m_token != Token::RPAREN)
+					error("expected )");
+				break;
+
+			default:
+				error("unexpected " + m_value);
+		}
+
+		next();
+		return result;
+	}
+
+	const EntryIndexFile &m_file;
+	const std::string &m_text;
+	std::vector<std::string> &m_columns;
+
+	std::size_t m_pos = 0, m_start = 0;
+	int m_depth = 0, m_operators = 0;
+	Token m_token;
+	std::string m_value;
+	double m_number = 0;
+};
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+EntryIndex &EntryIndex::instance()
+{
+	static EntryIndex s_instance;
+	return s_instance;
+}
+
+EntryIndex::EntryIndex()
+{
+	auto &config = mcfp::config::instance();
+
+	m_data_dir = config.get<std::string>("pdb-redo-db-dir");
+
+	if (config.has("entry-index"))
+		m_file = config.get<std::string>("entry-index");
+	else
+		m_file = fs::path(config.get<std::string>("pdb-redo-services-dir")) / "entry-index.bin";
+
+	m_interval = std::chrono::minutes(config.get<int>("entry-index-interval"));
+}
+
+EntryIndex::EntryIndex(const fs::path &dataDir, const fs::path &file, std::chrono::minutes interval)
+	: m_data_dir(dataDir)
+	, m_file(file)
+	, m_interval(interval)
+{
+}
+
+EntryIndex::~EntryIndex()
+{
+	stop();
+}
+
+void EntryIndex::start()
+{
+	if (m_interval.count() > 0 and not m_builder.joinable())
+		m_builder = std::thread(std::bind(&EntryIndex::runBuilder, this));
+}
+
+void EntryIndex::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_cv_m);
+		m_done = true;
+		m_cv.notify_all();
+	}
+
+	if (m_builder.joinable())
+		m_builder.join();
+}
+
+bool EntryIndex::idle(std::chrono::milliseconds period)
+{
+	std::unique_lock<std::mutex> lock(m_cv_m);
+	return not m_cv.wait_for(lock, period, [this]
+		{ return m_done; });
+}
+
+void EntryIndex::runBuilder()
+{
+	using namespace std::literals;
+
+	bool leader = false;
+	auto wait = 10s;
+
+	while (idle(wait))
+	{
+		try
+		{
+			// Only one process, of all server instances sharing the database, builds the index
+			if (not leader)
+				leader = prsm_db_connection::instance().try_advisory_lock(kEntryIndexLockKey);
+
+			if (not leader)
+			{
+				wait = 60s;
+				continue;
+			}
+
+			build();
+			wait = m_interval;
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Error building entry index: " << ex.what() << std::endl;
+
+			prsm_db_connection::instance().reset();
+			leader = false;
+			wait = 60s;
+		}
+	}
+}
+
+int64_t EntryIndex::getModificationTime(const fs::path &file, std::error_code &ec)
+{
+	return fs::last_write_time(file, ec).time_since_epoch().count();
+}
+
+std::shared_ptr<const EntryIndexFile> EntryIndex::getFile()
+{
+	std::error_code ec;
+	auto mtime = fs::last_write_time(m_file, ec);
+
+	std::unique_lock lock(m_mutex);
+
+	if (ec)
+	{
+		if (not m_current)
+			throw EntryIndexUnavailable();
+	}
+	else if (not m_current or mtime != m_mtime)
+	{
+		m_current = std::make_shared<EntryIndexFile>(m_file);
+		m_mtime = mtime;
+	}
+
+	return m_current;
+}
+
+// --------------------------------------------------------------------
+// Building the index. Values are collected per column, a column becomes a
+// number column when it contains any number, a boolean column when it only
+// contains booleans and otherwise a string column.
+
+namespace
+{
+
+// The values of a column while the index is built. Only the kinds of
+// values seen are recorded, string columns allocate no numbers.
+struct BuildColumn
+{
+	BuildColumn(std::size_t size)
+		: size(size)
+	{
+	}
+
+	void set(std::size_t row, const zeep::json::element &value)
+	{
+		if (value.is_number())
+		{
+			number(row) = value.as<double>();
+			hasNumber = true;
+		}
+		else if (value.is_boolean())
+		{
+			number(row) = value.as<bool>() ? 1 : 0;
+			hasBoolean = true;
+		}
+		else if (value.is_string())
+		{
+			strings[row] = value.as<std::string>();
+			hasString = true;
+		}
+	}
+
+	void copy(std::size_t row, const EntryIndexFile::Column &column, std::size_t oldRow)
+	{
+		if (column.isNull(oldRow))
+			return;
+
+		switch (column.type)
+		{
+			case EntryColumnType::NUMBER:
+				number(row) = column.numbers[oldRow];
+				hasNumber = true;
+				break;
+
+			case EntryColumnType::BOOLEAN:
+				number(row) = column.numbers[oldRow];
+				hasBoolean = true;
+				break;
+
+			case EntryColumnType::STRING:
+				strings[row] = column.string(oldRow);
+				hasString = true;
+				break;
+		}
+	}
+
+	EntryColumnType type() const
+	{
+		if (hasNumber)
+			return EntryColumnType::NUMBER;
+		return (hasBoolean and not hasString) ? EntryColumnType::BOOLEAN : EntryColumnType::STRING;
+	}
+
+	// The numbers are allocated when the first number or boolean is set
+	double &number(std::size_t row)
+	{
+		if (numbers.empty())
+			numbers.assign(size, kNaN);
+		return numbers[row];
+	}
+
+	std::size_t size;
+	bool hasNumber = false, hasBoolean = false, hasString = false;
+
+	std::vector<double> numbers;
+	std::map<std::size_t, std::string> strings;
+};
+
+struct EntryFile
+{
+	std::string id;
+	fs::path file;
+	int64_t mtime;
+};
+
+void writeIndex(const fs::path &file, const std::vector<EntryFile> &entries, const std::map<std::string, BuildColumn> &columns)
+{
+	std::ofstream out(file, std::ios::binary | std::ios::trunc);
+	if (not out.is_open())
+		throw std::runtime_error("Could not create " + file.string());
+
+	uint64_t offset = 0;
+	auto write = [&out, &offset](const void *data, std::size_t size)
+	{
+		out.write(static_cast<const char *>(data), size);
+		offset += size;
+	};
+
+	auto pad = [&]()
+	{
+		const char zeros[8] = {};
+		write(zeros, align8(offset) - offset);
+	};
+
+	const uint64_t n = entries.size();
+
+	IndexHeader header = {};
+	memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+	header.entryCount = n;
+	header.columnCount = columns.size();
+
+	// header is written again at the end, with the offsets filled in
+	write(&header, sizeof(header));
+
+	header.idsOffset = offset;
+	for (auto &e : entries)
+	{
+		char id[EntryIndexFile::kIDLength] = {};
+		e.id.copy(id, sizeof(id));
+		write(id, sizeof(id));
+	}
+	pad();
+
+	header.mtimesOffset = offset;
+	for (auto &e : entries)
+		write(&e.mtime, sizeof(e.mtime));
+
+	header.columnsOffset = offset;
+
+	std::vector<IndexColumn> descriptors(columns.size());
+	write(descriptors.data(), descriptors.size() * sizeof(IndexColumn));
+
+	auto d = descriptors.begin();
+	for (auto &[name, column] : columns)
+	{
+		auto &ic = *d++;
+
+		name.copy(ic.name, sizeof(ic.name));
+		ic.type = column.type();
+		ic.dataOffset = offset;
+
+		if (ic.type == EntryColumnType::STRING)
+		{
+			std::map<std::string, uint32_t> dictionary;
+			for (auto &[row, s] : column.strings)
+				dictionary.emplace(s, 0);
+
+			uint32_t nr = 0;
+			for (auto &[s, i] : dictionary)
+				i = nr++;
+
+			for (std::size_t row = 0; row < n; ++row)
+			{
+				auto s = column.strings.find(row);
+				uint32_t v = s == column.strings.end() ? UINT32_MAX : dictionary[s->second];
+				write(&v, sizeof(v));
+			}
+			pad();
+
+			ic.stringCount = dictionary.size();
+			ic.stringsOffset = offset;
+
+			uint64_t o = 0;
+			for (auto &[s, i] : dictionary)
+			{
+				write(&o, sizeof(o));
+				o += s.length();
+			}
+			write(&o, sizeof(o));
+
+			for (auto &[s, i] : dictionary)
+				write(s.data(), s.length());
+			pad();
+		}
+		else
+			write(column.numbers.data(), n * sizeof(double));
+	}
+
+	header.fileSize = offset;
+
+	out.seekp(0);
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	out.seekp(header.columnsOffset);
+	out.write(reinterpret_cast<const char *>(descriptors.data()), descriptors.size() * sizeof(IndexColumn));
+
+	out.close();
+	if (out.fail())
+		throw std::runtime_error("Error writing " + file.string());
+}
+
+} // namespace
+
+std::size_t EntryIndex::build()
+{
+	const std::regex kEntryRx(R"([0-9][0-9a-z]{3,7})");
+
+	std::error_code ec;
+
+	// Collect the data.json files, the databank is laid out as xy/1xyz
+	std::vector<EntryFile> entries;
+
+	for (auto &sub : fs::directory_iterator(m_data_dir, ec))
+	{
+		if (sub.path().filename().string().length() != 2 or not sub.is_directory(ec))
+			continue;
+
+		for (auto &dir : fs::directory_iterator(sub.path(), ec))
+		{
+			auto id = dir.path().filename().string();
+			if (not std::regex_match(id, kEntryRx))
+				continue;
+
+			auto file = dir.path() / "data.json";
+			auto mtime = getModificationTime(file, ec);
+			if (ec)
+				continue;
+
+			entries.push_back({ id, file, mtime });
+		}
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const EntryFile &a, const EntryFile &b)
+		{ return a.id < b.id; });
+
+	std::shared_ptr<const EntryIndexFile> current;
+	try
+	{
+		current = getFile();
+	}
+	catch (const std::exception &)
+	{
+		// no usable index yet, build from scratch
+	}
+
+	const std::size_t n = entries.size();
+
+	std::map<std::string, BuildColumn> columns;
+	auto getColumn = [&columns, n](const std::string &name) -> BuildColumn &
+	{
+		auto i = columns.find(name);
+		if (i == columns.end())
+			i = columns.emplace(name, BuildColumn(n)).first;
+		return i->second;
+	};
+
+	std::size_t parsed = 0;
+
+	for (std::size_t row = 0; row < n; ++row)
+	{
+		auto &e = entries[row];
+
+		if (current)
+		{
+			auto oldRow = current->find(e.id);
+			if (oldRow < current->size() and current->getMTime(oldRow) == e.mtime)
+			{
+				for (auto &c : current->getColumns())
+					getColumn(c.name).copy(row, c, oldRow);
+				continue;
+			}
+		}
+
+		++parsed;
+
+		try
+		{
+			std::ifstream file(e.file);
+			if (not file.is_open())
+				continue;
+
+			zeep::json::element data;
+			zeep::json::parse_json(file, data);
+
+			// precompute the rama-angles while the file is parsed anyway
+			if (data["rama-angles"].is_array())
+				RamaAnglesService::instance().update(RamaAnglesService::entryKey(e.id), e.file, data);
+
+			auto &properties = data["properties"];
+			for (auto p = properties.begin(); p != properties.end(); ++p)
+			{
+				if (p.key().length() < EntryIndexFile::kNameLength)
+					getColumn(p.key()).set(row, p.value());
+			}
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Error reading " << e.file << ": " << ex.what() << std::endl;
+		}
+	}
+
+	// Nothing changed when nothing was parsed and no entries were removed
+	if (current and parsed == 0 and current->size() == n)
+		return 0;
+
+	auto tmp = m_file;
+	tmp += ".tmp";
+
+	writeIndex(tmp, entries, columns);
+	fs::rename(tmp, m_file);
+
+	std::cerr << "Entry index rebuilt, " << n << " entries of which " << parsed << " were (re)read" << std::endl;
+
+	return parsed;
+}
+
+// --------------------------------------------------------------------
+
+zeep::json::element EntryIndex::query(const EntryQuery &query)
+{
+	auto file = getFile();
+
+	std::vector<std::string> used;
+
+	ExprPtr filter;
+	if (not query.filter.empty())
+		filter = FilterParser(*file, query.filter, used).parse();
+
+	std::vector<std::size_t> rows;
+	for (std::size_t row = 0; row < file->size(); ++row)
+	{
+		if (not filter or filter->eval(row).truth())
+			rows.push_back(row);
+	}
+
+	auto offset = std::min(query.offset, rows.size());
+	auto end = std::min(offset + std::min(query.limit, kMaxLimit), rows.size());
+
+	if (not query.sort.empty())
+	{
+		bool descending = query.sort.front() == '-';
+		auto name = descending ? query.sort.substr(1) : query.sort;
+
+		auto column = file->getColumn(name);
+		if (column == nullptr)
+			throw std::runtime_error("Unknown sort column " + name);
+
+		if (std::find(used.begin(), used.end(), name) == used.end())
+			used.push_back(name);
+
+		// missing values always go last, ties keep the pdb-id order
+		std::partial_sort(rows.begin(), rows.begin() + end, rows.end(), [column, descending](std::size_t a, std::size_t b)
+			{
+				bool na = column->isNull(a), nb = column->isNull(b);
+				if (na or nb)
+					return na == nb ? a < b : nb;
+
+				int d;
+				if (column->type == EntryColumnType::STRING)
+					d = column->string(a).compare(column->string(b));
+				else
+				{
+					auto va = column->numbers[a], vb = column->numbers[b];
+					d = va < vb ? -1 : (va > vb ? 1 : 0);
+				}
+
+				if (d == 0)
+					return a < b;
+				return descending ? d > 0 : d < 0;
+			});
+	}
+
+	std::vector<const EntryIndexFile::Column *> fields;
+	if (query.fields.size() == 1 and query.fields.front() == "*")
+	{
+		for (auto &c : file->getColumns())
+			fields.push_back(&c);
+	}
+	else
+	{
+		for (auto &name : query.fields.empty() ? used : query.fields)
+		{
+			auto column = file->getColumn(name);
+			if (column == nullptr)
+				throw std::runtime_error("Unknown column " + name);
+			fields.push_back(column);
+		}
+	}
+
+	zeep::json::element entries;
+	zeep::json::parse_json("[]", entries); // an empty array when nothing matches
+
+	for (auto i = offset; i < end; ++i)
+	{
+		auto row = rows[i];
+
+		zeep::json::element entry{
+			{ "pdb-id", file->getID(row) }
+		};
+
+		for (auto column : fields)
+			entry[column->name] = column->value(row);
+
+		entries.push_back(std::move(entry));
+	}
+
+	return zeep::json::element{
+		{ "total", rows.size() },
+		{ "entries", std::move(entries) }
+	};
+}
@@ -0,0 +1,194 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <zeep/json/element.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// --------------------------------------------------------------------
+// A columnar index of the properties in the data.json files of all
+// databank entries. The index is a single file that is memory mapped by
+// all server processes. One of them rebuilds it in the background,
+// parsing only the data.json files that changed since the last build.
+//
+// File layout, all offsets are from the start of the file:
+//
+//   header
+//   entry count pdb IDs, 8 characters zero padded, sorted
+//   entry count data.json modification times
+//   column count column descriptors
+//   the column data, for number and boolean columns entry count doubles
+//   with NaN for missing values, for string columns entry count string
+//   numbers followed by string count + 1 offsets into the characters
+
+enum class EntryColumnType : uint32_t
+{
+	NUMBER,
+	BOOLEAN,
+	STRING
+};
+
+struct EntryQuery
+{
+	// An expression selecting entries, e.g. "(RFREE - RFFIN) / RFREE > 0.05 and GOT_PROT"
+	std::string filter;
+
+	// The column to sort on, prefixed with a minus sign for descending order
+	std::string sort;
+
+	// The columns to return, "*" for all. The pdb-id is always returned,
+	// by default so are the columns used in filter and sort.
+	std::vector<std::string> fields;
+
+	std::size_t offset = 0, limit = 100;
+};
+
+// Read access to a memory mapped index file
+
+class EntryIndexFile
+{
+  public:
+	struct Column
+	{
+		std::string name;
+		EntryColumnType type;
+
+		const double *numbers = nullptr;	// number and boolean columns
+		const uint32_t *strings = nullptr;	// string columns, index into offsets
+		const uint64_t *offsets = nullptr;
+		const char *chars = nullptr;
+		std::size_t stringCount = 0;
+
+		bool isNull(std::size_t row) const;
+		double number(std::size_t row) const;
+		std::string_view string(std::size_t row) const;
+
+		zeep::json::element value(std::size_t row) const;
+	};
+
+	EntryIndexFile(const std::filesystem::path &file);
+	~EntryIndexFile();
+
+	EntryIndexFile(const EntryIndexFile &) = delete;
+	EntryIndexFile &operator=(const EntryIndexFile &) = delete;
+
+	std::size_t size() const { return m_size; }
+
+	std::string getID(std::size_t row) const;
+	int64_t getMTime(std::size_t row) const;
+
+	// The row for pdbID, or size() when not found
+	std::size_t find(const std::string &pdbID) const;
+
+	const std::vector<Column> &getColumns() const { return m_columns; }
+	const Column *getColumn(const std::string &name) const;
+
+	static constexpr std::size_t kIDLength = 8, kNameLength = 48;
+
+  private:
+	void *m_data = nullptr;
+	std::size_t m_length = 0;
+	std::size_t m_size = 0;
+	const char *m_ids = nullptr;
+	const int64_t *m_mtimes = nullptr;
+	std::vector<Column> m_columns;
+};
+
+// Thrown when the index is used before it was built for the first time
+class EntryIndexUnavailable : public std::runtime_error
+{
+  public:
+	EntryIndexUnavailable()
+		: std::runtime_error("The entry index is not available yet")
+	{
+	}
+};
+
+class EntryIndex
+{
+  public:
+	static EntryIndex &instance();
+
+	// An index of the databank in dataDir, stored in file. The server uses
+	// instance(), which takes these from the configuration.
+	EntryIndex(const std::filesystem::path &dataDir, const std::filesystem::path &file,
+		std::chrono::minutes interval = {});
+	~EntryIndex();
+
+	EntryIndex(const EntryIndex &) = delete;
+	EntryIndex &operator=(const EntryIndex &) = delete;
+
+	void start();
+	void stop();
+
+	// Returns an object with the total number of matching entries and
+	// an array with the requested part of them
+	zeep::json::element query(const EntryQuery &query);
+
+	// The index as currently on disk, reloaded when the file has changed
+	std::shared_ptr<const EntryIndexFile> getFile();
+
+	// The modification time of a data.json file as stored in the index
+	static int64_t getModificationTime(const std::filesystem::path &file, std::error_code &ec);
+
+	// Scan the databank and write a new index when anything changed.
+	// Returns the number of data.json files that were (re)read.
+	std::size_t build();
+
+	static constexpr std::size_t kMaxLimit = 10000;
+
+  private:
+	EntryIndex();
+
+	// Wait for period, returns false when the service is stopping
+	bool idle(std::chrono::milliseconds period);
+
+	void runBuilder();
+
+	std::filesystem::path m_data_dir, m_file;
+	std::chrono::minutes m_interval;
+
+	std::mutex m_mutex;
+	std::shared_ptr<const EntryIndexFile> m_current;
+	std::filesystem::file_time_type m_mtime;
+
+	bool m_done = false;
+	std::condition_variable m_cv;
+	std::mutex m_cv_m;
+	std::thread m_builder;
+};
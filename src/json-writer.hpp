@@ -0,0 +1,213 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <zeep/json/element.hpp>
+#include <zeep/nvp.hpp>
+#include <zeep/value-serializer.hpp>
+
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// --------------------------------------------------------------------
+// JsonWriter writes objects with a serialize method as JSON text directly
+// into a string. The result is the same as that of to_element followed by
+// writing out the element, without building the element tree first.
+
+class JsonWriter
+{
+  public:
+	JsonWriter(std::string &out)
+		: m_out(out)
+	{
+	}
+
+	JsonWriter(const JsonWriter &) = delete;
+	JsonWriter &operator=(const JsonWriter &) = delete;
+
+	template <typename T>
+	JsonWriter &operator&(const zeep::name_value_pair<T> &nvp)
+	{
+		if (not m_first)
+			m_out += ',';
+		m_first = false;
+
+		writeString(nvp.name());
+		m_out += ':';
+		write(nvp.value());
+
+		return *this;
+	}
+
+	template <typename T>
+	void write(const T &v)
+	{
+		if constexpr (std::is_same_v<T, bool>)
+			m_out += v ? "true" : "false";
+		else if constexpr (std::is_enum_v<T>)
+			writeString(zeep::value_serializer<T>::to_string(v));
+		else if constexpr (std::is_arithmetic_v<T>)
+			writeNumber(v);
+		else if constexpr (std::is_convertible_v<const T &, std::string_view>)
+			writeString(v);
+		else if constexpr (is_optional<T>::value)
+		{
+			if (v.has_value())
+				write(*v);
+			else
+				m_out += "null";
+		}
+		else if constexpr (is_time_point<T>::value)
+			writeString(zeep::value_serializer<T>::to_string(v));
+		else if constexpr (std::is_same_v<T, zeep::json::element>)
+		{
+			std::ostringstream s;
+			s << v;
+			m_out += s.str();
+		}
+		else if constexpr (is_container<T>::value)
+		{
+			m_out += '[';
+			bool first = true;
+			for (auto &e : v)
+			{
+				if (not first)
+					m_out += ',';
+				first = false;
+				write(e);
+			}
+			m_out += ']';
+		}
+		else
+		{
+			bool first = m_first;
+
+			m_out += '{';
+			m_first = true;
+			const_cast<T &>(v).serialize(*this, 0);
+			m_out += '}';
+
+			m_first = first;
+		}
+	}
+
+  private:
+	template <typename T>
+	struct is_optional : std::false_type
+	{
+	};
+
+	template <typename T>
+	struct is_optional<std::optional<T>> : std::true_type
+	{
+	};
+
+	template <typename T>
+	struct is_time_point : std::false_type
+	{
+	};
+
+	template <typename C, typename D>
+	struct is_time_point<std::chrono::time_point<C, D>> : std::true_type
+	{
+	};
+
+	template <typename T, typename = void>
+	struct is_container : std::false_type
+	{
+	};
+
+	template <typename T>
+	struct is_container<T, std::void_t<typename T::value_type, decltype(std::declval<const T &>().begin())>> : std::true_type
+	{
+	};
+
+	template <typename T>
+	void writeNumber(T v)
+	{
+		if constexpr (std::is_floating_point_v<T>)
+		{
+			if (not std::isfinite(v))
+			{
+				m_out += "null";
+				return;
+			}
+		}
+
+		char b[32];
+		auto r = std::to_chars(b, b + sizeof(b), v);
+		m_out.append(b, r.ptr);
+	}
+
+	void writeString(std::string_view s)
+	{
+		const char kHex[] = "0123456789abcdef";
+
+		m_out += '"';
+		for (char c : s)
+		{
+			switch (c)
+			{
+				case '"': m_out += "\\\""; break;
+				case '\\': m_out += "\\\\"; break;
+				case '\n': m_out += "\\n"; break;
+				case '\r': m_out += "\\r"; break;
+				case '\t': m_out += "\\t"; break;
+				default:
+					if (static_cast<unsigned char>(c) < 0x20)
+					{
+						m_out += "\\u00";
+						m_out += kHex[(c >> 4) & 0x0f];
+						m_out += kHex[c & 0x0f];
+					}
+					else
+						m_out += c;
+			}
+		}
+		m_out += '"';
+	}
+
+	std::string &m_out;
+	bool m_first = true;
+};
+
+// Convenience routine, returns v as JSON text
+
+template <typename T>
+std::string toJSON(const T &v)
+{
+	std::string result;
+	JsonWriter w(result);
+	w.write(v);
+	return result;
+}
@@ -0,0 +1,436 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "preflight.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// --------------------------------------------------------------------
+
+void InputValidator::fail(const std::string &message) const
+{
+	throw std::runtime_error("Input file " + m_file + ' ' + message);
+}
+
+// --------------------------------------------------------------------
+// MTZ files start with a short fixed header containing the location of
+// the text header, which is written after the reflection data. Only the
+// first bytes and the text header are kept.
+
+class MTZValidator : public InputValidator
+{
+  public:
+	MTZValidator(const fs::path &file)
+		: InputValidator(file)
+	{
+	}
+
+	void feed(const char *data, std::size_t length) override;
+	void finish() override;
+
+  private:
+	void parseStamp();
+
+	static constexpr std::size_t kStampSize = 12;
+	static constexpr std::size_t kMaxHeaderSize = 64 * 1024 * 1024;
+
+	std::uintmax_t m_size = 0;
+	std::string m_stamp;
+	std::int64_t m_headerPos = -1;	// -1 means unknown
+	std::string m_header;
+};
+
+void MTZValidator::feed(const char *data, std::size_t length)
+{
+	if (m_size < kStampSize)
+	{
+		auto n = std::min(length, kStampSize - static_cast<std::size_t>(m_size));
+		m_stamp.append(data, n);
+
+		if (m_stamp.length() == kStampSize)
+			parseStamp();
+	}
+
+	if (m_headerPos >= 0 and m_size + length > static_cast<std::uintmax_t>(m_headerPos))
+	{
+		auto skip = m_size < static_cast<std::uintmax_t>(m_headerPos) ? m_headerPos - m_size : 0;
+		m_header.append(data + skip, length - skip);
+
+		if (m_header.length() > kMaxHeaderSize)
+			fail("is not a valid MTZ file, the header is too large");
+	}
+
+	m_size += length;
+}
+
+void MTZValidator::parseStamp()
+{
+	if (m_stamp.compare(0, 4, "MTZ ") != 0)
+		fail("is not an MTZ file");
+
+	// The machine stamp tells us the byte order of the header location. Its
+	// first byte holds the real and complex formats, the second one the
+	// integer and character formats. An integer format of 1 means big endian.
+	bool bigEndian = ((static_cast<unsigned char>(m_stamp[9]) >> 4) & 0x0f) == 1;
+
+	std::uint32_t v = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		auto b = static_cast<std::uint32_t>(static_cast<unsigned char>(m_stamp[4 + i]));
+		v |= bigEndian ? b << (8 * (3 - i)) : b << (8 * i);
+	}
+
+	auto offset = static_cast<std::int32_t>(v);
+
+	// a negative value is used for files with a 64 bit header location,
+	// those are accepted without further checks
+	if (offset > 0)
+		m_headerPos = (static_cast<std::int64_t>(offset) - 1) * 4;
+}
+
+void MTZValidator::finish()
+{
+	if (m_stamp.length() < kStampSize)
+		fail("is not an MTZ file, it is too short");
+
+	if (m_headerPos < 0)
+		return;
+
+	if (m_size <= static_cast<std::uintmax_t>(m_headerPos))
+		fail("is truncated, the header is missing");
+
+	long ncol = -1, nref = -1;
+	bool end = false;
+	std::vector<char> types;
+
+	for (std::size_t p = 0; p + 80 <= m_header.length() and not end; p += 80)
+	{
+		std::string_view record(m_header.data() + p, 80);
+
+		if (record.compare(0, 4, "NCOL") == 0)
+		{
+			if (std::sscanf(std::string(record.substr(4)).c_str(), "%ld %ld", &ncol, &nref) != 2)
+				fail("has an invalid NCOL record");
+		}
+		else if (record.compare(0, 6, "COLUMN") == 0)
+		{
+			char label[81], type;
+			if (std::sscanf(std::string(record.substr(6)).c_str(), "%80s %c", label, &type) != 2)
+				fail("has an invalid COLUMN record");
+			types.push_back(type);
+		}
+		else if (record.compare(0, 3, "END") == 0)
+			end = true;
+	}
+
+	if (not end)
+		fail("is truncated, the header is incomplete");
+
+	if (ncol < 0 or static_cast<std::size_t>(ncol) != types.size())
+		fail("has a header where the number of columns does not match the column records");
+
+	if (nref <= 0)
+		fail("does not contain any reflections");
+
+	// The reflection data starts after the 80 byte fixed header
+	if (static_cast<std::int64_t>(ncol) * nref * 4 != m_headerPos - 80)
+		fail("is damaged, the size of the reflection data does not match the header");
+
+	if (std::count(types.begin(), types.end(), 'H') < 3)
+		fail("does not contain Miller indices");
+
+	if (std::none_of(types.begin(), types.end(), [](char t) { return t == 'F' or t == 'J' or t == 'G' or t == 'K'; }))
+		fail("does not contain amplitudes or intensities");
+}
+
+// --------------------------------------------------------------------
+// Validators for text files, these see the file line by line
+
+class LineValidator : public InputValidator
+{
+  public:
+	LineValidator(const fs::path &file)
+		: InputValidator(file)
+	{
+	}
+
+	void feed(const char *data, std::size_t length) override;
+	void finish() override;
+
+  protected:
+	virtual void line(std::string_view line) = 0;
+	virtual void done() = 0;
+
+	std::size_t m_lineNr = 0;
+
+	// In CIF files, lines starting with a semicolon delimit multi-line text
+	// fields. The contents of these should be skipped when looking at the
+	// structure of the file.
+	bool cifTextField(std::string_view line)
+	{
+		if (not line.empty() and line.front() == ';')
+		{
+			m_inTextField = not m_inTextField;
+			return true;
+		}
+
+		return m_inTextField;
+	}
+
+	bool m_inTextField = false;
+
+  private:
+	static constexpr std::size_t kMaxLineLength = 1024 * 1024;
+
+	void emit();
+
+	std::string m_line;
+};
+
+void LineValidator::feed(const char *data, std::size_t length)
+{
+	if (std::memchr(data, 0, length) != nullptr)
+		fail("is not a text file");
+
+	const char *end = data + length;
+	while (data < end)
+	{
+		auto eol = std::find(data, end, '\n');
+		m_line.append(data, eol);
+
+		if (m_line.length() > kMaxLineLength)
+			fail("is not a valid text file, it contains a line that is too long");
+
+		if (eol == end)
+			break;
+
+		emit();
+		data = eol + 1;
+	}
+}
+
+void LineValidator::emit()
+{
+	if (not m_line.empty() and m_line.back() == '\r')
+		m_line.pop_back();
+
+	++m_lineNr;
+	line(m_line);
+	m_line.clear();
+}
+
+void LineValidator::finish()
+{
+	if (not m_line.empty())
+		emit();
+
+	done();
+}
+
+// --------------------------------------------------------------------
+
+class CoordinatesValidator : public LineValidator
+{
+  public:
+	CoordinatesValidator(const fs::path &file)
+		: LineValidator(file)
+	{
+	}
+
+  protected:
+	void line(std::string_view line) override;
+	void done() override;
+
+  private:
+	enum class Format { Unknown, PDB, mmCIF } m_format = Format::Unknown;
+	bool m_atomSite = false;
+	std::size_t m_atoms = 0;
+};
+
+void CoordinatesValidator::line(std::string_view line)
+{
+	if (m_format == Format::Unknown)
+	{
+		if (line.find_first_not_of(" \t") == std::string_view::npos or line.front() == '#')
+			return;
+
+		m_format = line.compare(0, 5, "data_") == 0 ? Format::mmCIF : Format::PDB;
+	}
+
+	bool atom = line.compare(0, 4, "ATOM") == 0 or line.compare(0, 6, "HETATM") == 0;
+
+	if (m_format == Format::PDB)
+	{
+		if (atom)
+		{
+			if (line.length() < 54)
+				fail("contains an ATOM record without coordinates at line " + std::to_string(m_lineNr));
+			++m_atoms;
+		}
+	}
+	else if (not cifTextField(line))
+	{
+		if (line.compare(0, 11, "_atom_site.") == 0)
+			m_atomSite = true;
+		else if (atom and m_atomSite)
+			++m_atoms;
+	}
+}
+
+void CoordinatesValidator::done()
+{
+	switch (m_format)
+	{
+		case Format::Unknown:
+			fail("is empty");
+
+		case Format::PDB:
+			if (m_atoms == 0)
+				fail("is not a valid PDB file, it does not contain any ATOM or HETATM records");
+			break;
+
+		case Format::mmCIF:
+			if (not m_atomSite)
+				fail("is not a valid mmCIF file, it does not contain an atom_site category");
+			if (m_atoms == 0)
+				fail("is not a valid mmCIF file, it does not contain any atoms");
+			break;
+	}
+}
+
+// --------------------------------------------------------------------
+// Restraint files should consist of data blocks containing items and loops
+
+class RestraintsValidator : public LineValidator
+{
+  public:
+	RestraintsValidator(const fs::path &file)
+		: LineValidator(file)
+	{
+	}
+
+  protected:
+	void line(std::string_view line) override;
+	void done() override;
+
+  private:
+	std::size_t m_blocks = 0, m_loopLineNr = 0;
+	bool m_expectTag = false;
+};
+
+void RestraintsValidator::line(std::string_view line)
+{
+	if (cifTextField(line))
+		return;
+
+	auto p = line.find_first_not_of(" \t");
+	if (p == std::string_view::npos or line[p] == '#')
+		return;
+
+	line.remove_prefix(p);
+
+	if (m_expectTag and line.front() != '_')
+		fail("is not a valid CIF file, the loop_ at line " + std::to_string(m_loopLineNr) + " has no tags");
+	m_expectTag = false;
+
+	if (line.compare(0, 5, "data_") == 0)
+		++m_blocks;
+	else if (m_blocks == 0)
+		fail("is not a valid CIF file, line " + std::to_string(m_lineNr) + " is outside a data_ block");
+	else if (line.compare(0, 5, "loop_") == 0)
+	{
+		m_expectTag = true;
+		m_loopLineNr = m_lineNr;
+	}
+}
+
+void RestraintsValidator::done()
+{
+	if (m_inTextField)
+		fail("is not a valid CIF file, a text field is not terminated");
+
+	if (m_expectTag)
+		fail("is not a valid CIF file, it ends with an empty loop_");
+
+	if (m_blocks == 0)
+		fail("is not a valid CIF file, it does not contain any data_ blocks");
+}
+
+// --------------------------------------------------------------------
+
+class SequenceValidator : public LineValidator
+{
+  public:
+	SequenceValidator(const fs::path &file)
+		: LineValidator(file)
+	{
+	}
+
+  protected:
+	void line(std::string_view line) override
+	{
+		if (line.empty() or line.front() == '>' or line.front() == ';')
+			return;
+
+		m_residues += std::count_if(line.begin(), line.end(), [](char ch) { return std::isalpha(static_cast<unsigned char>(ch)); });
+	}
+
+	void done() override
+	{
+		if (m_residues == 0)
+			fail("does not contain a sequence");
+	}
+
+  private:
+	std::size_t m_residues = 0;
+};
+
+// --------------------------------------------------------------------
+
+std::unique_ptr<InputValidator> InputValidator::create(const std::string &type, const fs::path &file)
+{
+	std::unique_ptr<InputValidator> result;
+
+	if (type == "MTZ")
+		result.reset(new MTZValidator(file));
+	else if (type == "PDB")
+		result.reset(new CoordinatesValidator(file));
+	else if (type == "CIF")
+		result.reset(new RestraintsValidator(file));
+	else if (type == "SEQ")
+		result.reset(new SequenceValidator(file));
+
+	return result;
+}
@@ -0,0 +1,60 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+
+// --------------------------------------------------------------------
+// Preflight checks on the input files of a run. A validator is fed the
+// decompressed data while it is written to disk, so there is no extra
+// pass over the data. Problems are reported by throwing an exception
+// with a message that can be shown to the user.
+
+class InputValidator
+{
+  public:
+	virtual ~InputValidator() = default;
+
+	virtual void feed(const char *data, std::size_t length) = 0;
+	virtual void finish() = 0;
+
+	// Create the validator for an input type (PDB, MTZ, CIF or SEQ),
+	// returns an empty pointer for unknown types.
+	static std::unique_ptr<InputValidator> create(const std::string &type, const std::filesystem::path &file);
+
+  protected:
+	InputValidator(const std::filesystem::path &file)
+		: m_file(file.filename().string())
+	{
+	}
+
+	[[noreturn]] void fail(const std::string &message) const;
+
+	std::string m_file;
+};
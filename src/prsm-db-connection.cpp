@@ -98,6 +98,13 @@ void prsm_db_connection::reset()
 	s_connection.reset();
 }
 
+bool prsm_db_connection::try_advisory_lock(int64_t key)
+{
+	pqxx::nontransaction tx(get_connection());
+	auto r = tx.exec1("SELECT pg_try_advisory_lock(" + std::to_string(key) + ")");
+	return r[0].as<bool>();
+}
+
 // --------------------------------------------------------------------
 
 bool prsm_db_error_handler::create_error_reply(const zeep::http::request& req, std::exception_ptr eptr, zeep::http::reply& reply)
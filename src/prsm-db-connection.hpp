@@ -59,6 +59,10 @@ class prsm_db_connection
 
 	void reset();
 
+	// Try to obtain a session level advisory lock for the connection of the
+	// current thread. The lock is released when that connection closes.
+	bool try_advisory_lock(int64_t key);
+
   private:
 	prsm_db_connection(const prsm_db_connection&) = delete;
 	prsm_db_connection& operator=(const prsm_db_connection&) = delete;
@@ -26,7 +26,13 @@
 
 #include "api-controller.hpp"
 #include "data-service.hpp"
+#include "entry-classes.hpp"
+#include "entry-index.hpp"
+#include "json-writer.hpp"
 #include "prsm-db-connection.hpp"
+#include "rama-angles.hpp"
+#include "signed-url.hpp"
+#include "stats-service.hpp"
 #include "user-service.hpp"
 
 #include "revision.hpp"
@@ -36,6 +42,10 @@
 #include <charconv>
 #include <functional>
 #include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <thread>
 #include <tuple>
 
@@ -58,100 +68,6 @@ using json = zeep::json::element;
 
 // --------------------------------------------------------------------
 
-class entry_class_expression_object : public zh::expression_utility_object<entry_class_expression_object>
-{
-  public:
-	static constexpr const char *name() { return "entry"; }
-
-	virtual zh::object evaluate(const zh::scope &scope, const std::string &methodName,
-		const std::vector<zh::object> &parameters) const
-	{
-		zh::object result;
-
-		try
-		{
-			if (methodName == "class" and parameters.size() == 2)
-			{
-				result = "";
-
-				if (parameters.front().is_number() and parameters.back().is_number())
-				{
-					double o = parameters.front().as<double>();
-					double f = parameters.back().as<double>();
-
-					if (o > 1.0)
-					{
-						if (f < o)
-							result = "better";
-						else if (f > o)
-							result = "worse";
-					}
-					else if (f > 1.0)
-						result = "worse";
-				}
-			}
-			else if (methodName == "percClass" and parameters.size() == 2)
-			{
-				result = "";
-
-				if (parameters.front().is_number() and parameters.back().is_number())
-				{
-					double o = parameters.front().as<double>();
-					double f = parameters.back().as<double>();
-
-					if (f == 100 || f > o)
-						result = "better";
-					else if (f < o)
-						result = "worse";
-				}
-			}
-			else if (methodName == "rffinClass" and parameters.size() == 1)
-			{
-				result = "";
-
-				auto &data = parameters.front();
-
-				if (data["RFFIN"].is_number() and data["SIGRFCAL"].is_number())
-				{
-					auto rffin = data["RFFIN"].as<double>();
-					auto sigrfcal = data["SIGRFCAL"].as<double>();
-
-					if (data["RFREE"].is_null() or data["ZCALERR"] == true or data["TSTCNT"] != data["NTSTCNT"])
-					{
-						if (data["RFCALUNB"].is_number())
-						{
-							auto rfcalunb = data["RFCALUNB"].as<double>();
-
-							if (rffin < (rfcalunb - 2.6 * sigrfcal))
-								result = "better";
-							else if (rffin > (rfcalunb + 2.6 * sigrfcal))
-								result = "worse";
-						}
-					}
-					else if (data["RFCAL"].is_number())
-					{
-						double rfcal = data["RFCAL"].as<double>();
-
-						if (rffin < (rfcal - 2.6 * sigrfcal))
-							result = "better";
-						else if (rffin > (rfcal + 2.6 * sigrfcal))
-							result = "worse";
-					}
-				}
-			}
-		}
-		catch (const std::exception &ex)
-		{
-			std::cerr << ex.what() << std::endl;
-		}
-
-		return result;
-	}
-
-} s_entry_class_expression_object;
-
-// --------------------------------------------------------------------
-
 class version_format_expression_object : public zh::expression_utility_object<version_format_expression_object>
 {
   public:
@@ -199,17 +115,44 @@ class version_format_expression_object : public zh::expression_utility_object<ve
 
 // --------------------------------------------------------------------
 
-json create_entry_data(json &data, const fs::path &dir, const std::vector<std::string> &files)
+// When ramaLink is given, the rama-angles are not included but fetched by
+// the page in their binary form from that location. Percentiles and
+// classes are calculated when not given.
+
+json create_entry_data(json &data, const fs::path &dir, const std::vector<std::string> &files,
+	std::optional<StatsPercentiles> percentiles = {}, const std::optional<std::string> &ramaLink = {},
+	std::optional<EntryClasses> classes = {})
 {
 	auto pdbID = data["pdbid"].as<std::string>();
 
 	zeep::json::element entry{
 		{ "id", data["pdbid"] },
 		{ "dbEntry", false },
-		{ "data", std::move(data["properties"]) },
-		{ "rama-angles", std::move(data["rama-angles"]) }
+		{ "data", std::move(data["properties"]) }
 	};
 
+	if (not ramaLink)
+		entry["rama-angles"] = std::move(data["rama-angles"]);
+	else if (data["rama-angles"].is_array())
+		entry["link"]["rama_angles"] = *ramaLink;
+
+	try
+	{
+		if (not percentiles)
+			percentiles = StatsService::instance().getPercentiles(entry["data"]);
+
+		if (percentiles)
+			to_element(entry["percentiles"], *percentiles);
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << "Could not calculate percentiles: " << ex.what() << std::endl;
+	}
+
+	if (not classes)
+		classes = EntryClasses::create(entry["data"], percentiles);
+	to_element(entry["classes"], *classes);
+
 	auto &link = entry["link"];
 	for (fs::path file : files)
 	{
@@ -249,7 +192,7 @@ json create_entry_data(json &data, const fs::path &dir, const std::vector<std::s
 	return entry;
 }
 
-json create_entry_data(Run &run, const fs::path &basePath)
+json create_entry_data(Run &run, const fs::path &basePath, const std::string &ramaLink)
 {
 	auto dataJsonFile = run.getResultFile("data.json");
 	std::ifstream dataJson(dataJsonFile);
@@ -260,34 +203,106 @@ json create_entry_data(Run &run, const fs::path &basePath)
 	zeep::json::element data;
 	zeep::json::parse_json(dataJson, data);
 
-	return create_entry_data(data, basePath, run.getResultFileList());
+	std::optional<StatsPercentiles> percentiles;
+	std::optional<EntryClasses> classes;
+	if (run.score)
+	{
+		percentiles = run.score->percentiles;
+		classes = run.score->classes;
+	}
+
+	return create_entry_data(data, basePath, run.getResultFileList(), percentiles, ramaLink, classes);
+}
+
+// The rama-angles in binary form, see rama-angles.hpp
+
+// Set the ETag of reply, returns true and makes it a 304 reply when the
+// client already has this version.
+
+bool check_etag(const zh::scope &scope, zh::reply &reply, const std::string &etag)
+{
+	reply.set_header("ETag", etag);
+	reply.set_header("Cache-Control", "no-cache");
+
+	bool result = scope.get_request().get_header("If-None-Match") == etag;
+	if (result)
+		reply.set_status(zh::not_modified);
+
+	return result;
+}
+
+zh::reply create_rama_angles_reply(const zh::scope &scope, const std::string &key, const fs::path &dataJson)
+{
+	auto angles = RamaAnglesService::instance().get(key, dataJson);
+
+	zh::reply reply(zh::ok);
+
+	if (not check_etag(scope, reply, angles->etag))
+		reply.set_content(angles->data, "application/octet-stream");
+
+	return reply;
+}
+
+// A strong ETag for what is shown of a databank entry. It changes with
+// the data.json of the entry, with the files in its directory, with the
+// statistics file the percentiles come from and with each new build of
+// this server.
+
+std::string create_entry_etag(const std::string &kind, const std::string &pdbID, const std::optional<std::string> &attic)
+{
+	static const std::string kBuildID = std::to_string(std::hash<std::string>{}(
+		std::string(kVersionNumber) + '-' + std::to_string(kBuildNumber) + '-' + kRevisionDate));
+
+	auto dataJson = DataService::instance().getFile(pdbID, "data.json", attic);
+
+	std::error_code ec;
+	auto mtime = fs::last_write_time(dataJson, ec);
+	auto size = ec ? 0 : fs::file_size(dataJson, ec);
+	auto dirMTime = ec ? fs::file_time_type{} : fs::last_write_time(dataJson.parent_path(), ec);
+
+	if (ec)
+		throw zh::not_found;
+
+	// without statistics there are no percentiles, the time is then the same each time
+	auto statsMTime = fs::last_write_time(StatsService::instance().getFile(), ec);
+
+	std::ostringstream result;
+	result << '"' << kind << '-' << kBuildID << '-' << std::hex
+		   << mtime.time_since_epoch().count() << '-' << size << '-' << dirMTime.time_since_epoch().count() << '-'
+		   << statsMTime.time_since_epoch().count() << '"';
+	return result.str();
 }
 
 // --------------------------------------------------------------------
+// The log of a run that has not finished is shown live. The page gets
+// the last part of the log, the script fetches the rest from logURL.
+
+const std::uintmax_t kLogTailSize = 64 * 1024;
 
-struct Stats
+void put_log_tail(zh::scope &scope, Run &run, const std::string &logURL)
 {
-	double RFREE, RFFIN, OZRAMA, FZRAMA, OCHI12, FCHI12, URESO;
+	std::error_code ec;
+	auto size = fs::file_size(run.getResultFile("process.log"), ec);
 
-	Stats() {}
-	Stats(double RFREE, double RFFIN, double OZRAMA, double FZRAMA, double OCHI12, double FCHI12, double URESO)
-		: RFREE(RFREE), RFFIN(RFFIN), OZRAMA(OZRAMA), FZRAMA(FZRAMA), OCHI12(OCHI12), FCHI12(FCHI12), URESO(URESO) {}
-	
-	Stats(const Stats &) = default;
-	Stats &operator=(const Stats &) = default;
+	auto log = run.getLog(not ec and size > kLogTailSize ? size - kLogTailSize : 0);
 
-	template <typename Archive>
-	void serialize(Archive &ar, unsigned long version)
-	{
-		ar & zeep::make_nvp("RFREE", RFREE)
-		   & zeep::make_nvp("RFFIN", RFFIN)
-		   & zeep::make_nvp("OZRAMA", OZRAMA)
-		   & zeep::make_nvp("FZRAMA", FZRAMA)
-		   & zeep::make_nvp("OCHI12", OCHI12)
-		   & zeep::make_nvp("FCHI12", FCHI12)
-		   & zeep::make_nvp("URESO", URESO);
-	}
-};
+	scope.put("log", log.text);
+	scope.put("log-offset", log.offset);
+	scope.put("log-url", logURL);
+	scope.put("status", log.status);
+}
+
+zh::reply create_log_reply(Run &run, std::optional<std::uintmax_t> offset, std::optional<int> wait)
+{
+	json log;
+	to_element(log, run.getLog(offset.value_or(0), std::chrono::seconds(wait.value_or(0))));
+
+	zh::reply reply(zh::ok);
+	reply.set_content(log);
+	return reply;
+}
+
+// --------------------------------------------------------------------
 
 class GFXRESTController : public zeep::http::rest_controller
 {
@@ -295,54 +310,47 @@ class GFXRESTController : public zeep::http::rest_controller
 	GFXRESTController()
 		: zh::rest_controller("gfx")
 	{
-		map_get_request("statistics-for-box-plot", &GFXRESTController::get_statistics_for_box_plot, "ureso");
+		map_get_request("statistics-for-box-plot", &GFXRESTController::get_statistics_for_box_plot, "ureso", "summary");
 	}
 
-	std::vector<Stats> get_statistics_for_box_plot(double ureso)
+	// Either the statistics rows, or only what is needed to draw the box plots
+	json get_statistics_for_box_plot(double ureso, std::optional<bool> summary)
 	{
-		auto &config = mcfp::config::instance();
-		fs::path toolsDir = config.get<std::string>("pdb-redo-tools-dir");
-		std::ifstream f(toolsDir / "pdb_redo_stats.csv");
-		if (not f.is_open())
-			throw std::runtime_error("Could not open statistics file");
-		
-		std::string line;
-		getline(f, line);	// skip first
+		json result;
 
-		std::vector<Stats> stats;
+		if (summary.value_or(false))
+			to_element(result, StatsService::instance().getSummary(ureso));
+		else
+			to_element(result, StatsService::instance().getNearest(ureso));
 
-		while (getline(f, line))
-		{
-			std::vector<std::string> fld;
-			zeep::split(fld, line, ",");
-			if (fld.size() != 7)
-				continue;
-			stats.emplace_back(stod(fld[0]), stod(fld[1]), stod(fld[2]), stod(fld[3]), stod(fld[4]), stod(fld[5]), stod(fld[6]));
-		}
+		return result;
+	}
+};
 
-		sort(stats.begin(), stats.end(), [ureso](const Stats &a, const Stats &b) {
-			auto ad = (a.URESO - ureso) * (a.URESO - ureso);
-			auto bd = (b.URESO - ureso) * (b.URESO - ureso);
-			return ad < bd;
-		});
+// --------------------------------------------------------------------
+// JSON access to the databank for scripts, next to the pages in DbController
 
-		auto mm = std::accumulate(stats.begin(), stats.begin() + 1000,
-			std::tuple<double,double>{ std::numeric_limits<double>::max(), std::numeric_limits<double>::min() },
-			[](std::tuple<double,double> cur, const Stats &stat)
-			{
-				if (std::get<0>(cur) > stat.URESO)
-					std::get<0>(cur) = stat.URESO;
-				if (std::get<1>(cur) < stat.URESO)
-					std::get<1>(cur) = stat.URESO;
-				return cur;
-			});
-		
-		stats.erase(
-			std::remove_if(stats.begin(), stats.end(),
-				[mmin = std::get<0>(mm), mmax = std::get<1>(mm)](const Stats &stat) { return stat.URESO < mmin or stat.URESO > mmax; }),
-			stats.end());
+class DbRESTController : public zeep::http::rest_controller
+{
+  public:
+	DbRESTController()
+		: zh::rest_controller("db")
+	{
+		map_post_request("summary", &DbRESTController::get_summary, "ids", "fields");
+	}
 
-		return stats;
+	// ids and fields are separated by commas or white space
+	json get_summary(const std::string &ids, const std::optional<std::string> &fields)
+	{
+		return DataService::instance().getSummaries(split_list(ids), split_list(fields.value_or("")));
+	}
+
+  private:
+	static std::vector<std::string> split_list(const std::string &s)
+	{
+		std::vector<std::string> result;
+		zeep::split(result, s, ", \t\r\n", true);
+		return result;
 	}
 };
 
@@ -357,13 +365,17 @@ class JobController : public zh::html_controller
 		map_get("", &JobController::getJobListing);
 		map_post("", &JobController::postJob, "mtz", "coords", "restraints", "sequence", "params");
 
-		map_get("output/{job-id}/{file}", &JobController::getOutputFile, "job-id", "file");
+		map_get("output/{job-id}/{file}", &JobController::getOutputFile, "job-id", "file", "include", "exclude", "format");
 		map_get("image/{job-id}", &JobController::getImageFile, "job-id");
 		map_get("result/{job-id}", &JobController::getResult, "job-id");
 		map_get("entry/{job-id}", &JobController::getEntry, "job-id");
+		map_get("rama/{job-id}", &JobController::getRamaAngles, "job-id");
+		map_get("log/{job-id}", &JobController::getLog, "job-id", "offset", "wait");
 		map_delete("{job-id}", &JobController::deleteJob, "job-id");
 
 		map_get("status", &JobController::getStatus, "ids");
+		map_get("zipped", &JobController::getZippedRuns, "ids", "include", "exclude", "format");
+		map_post("zipped", &JobController::getZippedRuns, "ids", "include", "exclude", "format");
 	}
 
 	zh::reply getJobListing(const zh::scope &scope)
@@ -402,7 +414,9 @@ class JobController : public zh::html_controller
 		return zh::reply::redirect("/job", zh::see_other);
 	}
 
-	zh::reply getOutputFile(const zh::scope &scope, unsigned long job_id, const std::string &file)
+	zh::reply getOutputFile(const zh::scope &scope, unsigned long job_id, const std::string &file,
+		const std::optional<std::string> &include, const std::optional<std::string> &exclude,
+		const std::optional<std::string> &format)
 	{
 		auto credentials = scope.get_credentials();
 		auto run = RunService::instance().getRun(credentials["username"].as<std::string>(), job_id);
@@ -411,8 +425,9 @@ class JobController : public zh::html_controller
 
 		if (file == "zipped")
 		{
-			auto [f, name] = run.getZippedResultFile();
-			result.set_content(f, "application/zip");
+			auto archiveFormat = selectArchiveFormat(format, scope.get_request().get_header("Accept"));
+			auto [f, name] = run.getZippedResultFile({ include, exclude }, archiveFormat);
+			result.set_content(f, archiveContentType(archiveFormat));
 			result.set_header("content-disposition", "attachement; filename = \"" + name + "\"");
 		}
 		else
@@ -457,7 +472,7 @@ class JobController : public zh::html_controller
 
 		if (r.status == RunStatus::ENDED)
 		{
-			auto entry = create_entry_data(r, "/job/output/" + std::to_string(job_id));
+			auto entry = create_entry_data(r, "/job/output/" + std::to_string(job_id), "/job/rama/" + std::to_string(job_id));
 
 			zh::scope sub(scope);
 			sub.put("entry", entry);
@@ -465,23 +480,25 @@ class JobController : public zh::html_controller
 			return get_template_processor().create_reply_from_template("job-result", sub);
 		}
 
-		auto f = r.getResultFile("process.log");
-		std::ifstream in(f);
-		std::stringstream content;
-		content << in.rdbuf();
-
-		sub.put("log", content.str());
-		sub.put("status", r.status);
+		put_log_tail(sub, r, "/job/log/" + std::to_string(job_id));
 
 		return get_template_processor().create_reply_from_template("job-error", sub);
 	}
 
+	zh::reply getLog(const zh::scope &scope, unsigned long job_id, std::optional<std::uintmax_t> offset, std::optional<int> wait)
+	{
+		auto credentials = scope.get_credentials();
+		auto r = RunService::instance().getRun(credentials["username"].as<std::string>(), job_id);
+
+		return create_log_reply(r, offset, wait);
+	}
+
 	zh::reply getEntry(const zh::scope &scope, unsigned long job_id)
 	{
 		auto credentials = scope.get_credentials();
 		auto r = RunService::instance().getRun(credentials["username"].as<std::string>(), job_id);
 
-		auto entry = create_entry_data(r, "/job/output/" + std::to_string(job_id));
+		auto entry = create_entry_data(r, "/job/output/" + std::to_string(job_id), "/job/rama/" + std::to_string(job_id));
 
 		zh::scope sub(scope);
 		sub.put("entry", entry);
@@ -489,6 +506,14 @@ class JobController : public zh::html_controller
 		return get_template_processor().create_reply_from_template("entry::tables", sub);
 	}
 
+	zh::reply getRamaAngles(const zh::scope &scope, unsigned long job_id)
+	{
+		auto credentials = scope.get_credentials();
+		auto r = RunService::instance().getRun(credentials["username"].as<std::string>(), job_id);
+
+		return create_rama_angles_reply(scope, RamaAnglesService::runKey(r.user, r.id), r.getResultFile("data.json"));
+	}
+
 	zh::reply deleteJob(const zh::scope &scope, unsigned long job_id)
 	{
 		auto credentials = scope.get_credentials();
@@ -497,6 +522,22 @@ class JobController : public zh::html_controller
 		return zh::reply::stock_reply(zh::ok);
 	}
 
+	zh::reply getZippedRuns(const zh::scope &scope, std::vector<unsigned long> job_ids,
+		const std::optional<std::string> &include, const std::optional<std::string> &exclude,
+		const std::optional<std::string> &format)
+	{
+		auto credentials = scope.get_credentials();
+		auto archiveFormat = selectArchiveFormat(format, scope.get_request().get_header("Accept"));
+
+		auto [f, name] = RunService::instance().getZippedRuns(credentials["username"].as<std::string>(), job_ids,
+			{ include, exclude }, archiveFormat);
+
+		zh::reply result(zh::ok);
+		result.set_content(f, archiveContentType(archiveFormat));
+		result.set_header("content-disposition", "attachement; filename = \"" + name + "\"");
+		return result;
+	}
+
 	zh::reply getStatus(const zh::scope &scope, std::vector<unsigned long> job_ids)
 	{
 		auto credentials = scope.get_credentials();
@@ -515,6 +556,54 @@ class JobController : public zh::html_controller
 	}
 };
 
+// --------------------------------------------------------------------
+// Downloads using a signed URL, these do not need a login
+
+class SignedDownloadController : public zh::html_controller
+{
+  public:
+	SignedDownloadController()
+		: zh::html_controller("signed")
+	{
+		map_get("{user}/{job-id}/{file}", &SignedDownloadController::getFile, "user", "job-id", "file", "expires", "signature", "md5", "format");
+	}
+
+	zh::reply getFile(const zh::scope &scope, const std::string &user, unsigned long job_id, const std::string &file,
+		std::optional<long> expires, std::optional<std::string> signature, std::optional<std::string> md5, std::optional<std::string> format)
+	{
+		if (not expires.has_value())
+			return zh::reply::stock_reply(zh::forbidden);
+
+		if (not SignedURLService::instance().verify(user, job_id, file, *expires, signature.value_or(""), md5.value_or("")))
+			return zh::reply::stock_reply(zh::forbidden);
+
+		auto run = RunService::instance().getRun(user, job_id);
+
+		zh::reply result(zh::ok);
+
+		if (file == "zipped")
+		{
+			auto archiveFormat = selectArchiveFormat(format, scope.get_request().get_header("Accept"));
+			auto [f, name] = run.getZippedResultFile({}, archiveFormat);
+			result.set_content(f, archiveContentType(archiveFormat));
+			result.set_header("content-disposition", "attachement; filename = \"" + name + "\"");
+		}
+		else
+		{
+			auto f = run.getResultFile(file);
+
+			std::error_code ec;
+			if (not fs::exists(f, ec))
+				return zh::reply::stock_reply(zh::not_found);
+
+			result.set_content(new std::ifstream(f, std::ios::binary), "application/octet-stream");
+			result.set_header("content-disposition", "attachement; filename = \"" + f.filename().string() + "\"");
+		}
+
+		return result;
+	}
+};
+
 // --------------------------------------------------------------------
 
 class RootController : public zh::html_controller
@@ -570,6 +659,8 @@ zh::reply RootController::handle_entry(const zh::scope &scope, const zeep::json:
 	entry["data"] = std::move(data["properties"]);
 	entry["rama-angles"] = std::move(data["rama-angles"]);
 
+	to_element(entry["classes"], EntryClasses::create(entry["data"], {}));
+
 	if (data_link.has_value())
 	{
 		auto &link = entry["link"];
@@ -630,22 +721,28 @@ class AdminController : public zh::html_controller
 	AdminController()
 		: zh::html_controller("admin")
 	{
-		map_get("", &AdminController::admin, "tab");
+		map_get("", &AdminController::admin, "tab", "count");
+		map_get("usage", &AdminController::handle_usage);
 		map_get("job/{user}/{id}/output/{file}", &AdminController::handle_get_job_file, "user", "id", "file");
+		map_get("job/{user}/{id}/log", &AdminController::job_log, "user", "id", "offset", "wait");
+		map_get("job/{user}/{id}/rama", &AdminController::job_rama_angles, "user", "id");
 		map_get("job/{user}/{id}", &AdminController::job, "user", "id");
 		map_get("delete/jobs/{user}/{id}", &AdminController::handle_delete_job, "user", "id");
 		map_get("delete/{tab}/{id}", &AdminController::handle_delete, "tab", "id");
 	}
 
-	zh::reply admin(const zh::scope &scope, std::optional<std::string> tab);
+	zh::reply admin(const zh::scope &scope, std::optional<std::string> tab, std::optional<unsigned long> count);
 	zh::reply job(const zh::scope &scope, const std::string &user, unsigned long id);
+	zh::reply job_log(const zh::scope &scope, const std::string &user, unsigned long id, std::optional<std::uintmax_t> offset, std::optional<int> wait);
+	zh::reply job_rama_angles(const zh::scope &scope, const std::string &user, unsigned long id);
+	zh::reply handle_usage(const zh::scope &scope);
 	zh::reply handle_get_job_file(const zh::scope &scope, const std::string &user, unsigned long id, const std::string &file);
 
 	zh::reply handle_delete(const zh::scope &scope, const std::string &tab, unsigned long id);
 	zh::reply handle_delete_job(const zh::scope &scope, const std::string &user, unsigned long id);
 };
 
-zh::reply AdminController::admin(const zh::scope &scope, std::optional<std::string> tab)
+zh::reply AdminController::admin(const zh::scope &scope, std::optional<std::string> tab, std::optional<unsigned long> count)
 {
 	zh::scope sub(scope);
 
@@ -666,12 +763,24 @@ zh::reply AdminController::admin(const zh::scope &scope, std::optional<std::stri
 		json users;
 		auto u = UserService::instance().getAllUsers();
 		to_element(users, u);
+
+		std::map<std::string, DiskUsage> usage;
+		for (auto &du : RunService::instance().getDiskUsage())
+			usage[du.user] = du;
+
+		for (auto &user : users)
+		{
+			auto &du = usage[user["name"].as<std::string>()];
+			user["runs"] = du.runs;
+			user["disk-usage"] = du.size;
+		}
+
 		sub.put("users", users);
 	}
 	else if (active == "jobs")
 	{
 		json runs;
-		auto r = RunService::instance().getAllRuns();
+		auto r = RunService::instance().getAllRuns(count.value_or(0));
 		to_element(runs, r);
 		sub.put("runs", runs);
 	}
@@ -682,17 +791,40 @@ zh::reply AdminController::admin(const zh::scope &scope, std::optional<std::stri
 		to_element(updates, ur);
 		sub.put("updates", updates);
 	}
+	else if (active == "queue")
+	{
+		json queue;
+		to_element(queue, RunService::instance().getQueueState());
+		sub.put("queue", queue);
+	}
+	else if (active == "retention")
+	{
+		json retention, candidates;
+		auto &runService = RunService::instance();
+		to_element(retention, runService.getRetentionStats());
+		to_element(candidates, runService.getRetentionCandidates(count.value_or(250)));
+		sub.put("retention", retention);
+		sub.put("candidates", candidates);
+	}
 
 	return get_template_processor().create_reply_from_template("admin", sub);
 }
 
+zh::reply AdminController::handle_usage(const zh::scope &scope)
+{
+	zh::reply rep(zh::ok);
+	rep.set_content(toJSON(RunService::instance().getDiskUsage()), "application/json");
+	return rep;
+}
+
 zh::reply AdminController::job(const zh::scope &scope, const std::string &user, unsigned long job_id)
 {
 	auto run = RunService::instance().getRun(user, job_id);
 
 	if (run.status == RunStatus::ENDED)
 	{
-		auto entry = create_entry_data(run, "/admin/job/" + user + '/' + std::to_string(job_id) + "/output/");
+		auto entry = create_entry_data(run, "/admin/job/" + user + '/' + std::to_string(job_id) + "/output/",
+			"/admin/job/" + user + '/' + std::to_string(job_id) + "/rama");
 
 		zh::scope sub(scope);
 		sub.put("entry", entry);
@@ -700,17 +832,29 @@ zh::reply AdminController::job(const zh::scope &scope, const std::string &user,
 		return get_template_processor().create_reply_from_template("admin-job-result", sub);
 	}
 
-	auto f = run.getResultFile("process.log");
+	if (not fs::exists(run.getResultFile("process.log")))
+		return zh::reply::stock_reply(zh::not_found);
 
-	std::error_code ec;
-	if (fs::exists(f, ec))
-	{
-		zh::reply result(zh::ok);
-		result.set_content(new std::ifstream(f), "text/plain");
-		return result;
-	}
+	zh::scope sub(scope);
+	sub.put("job-id", job_id);
 
-	return zh::reply::stock_reply(zh::not_found);
+	put_log_tail(sub, run, "/admin/job/" + user + '/' + std::to_string(job_id) + "/log");
+
+	return get_template_processor().create_reply_from_template("job-error", sub);
+}
+
+zh::reply AdminController::job_log(const zh::scope &scope, const std::string &user, unsigned long job_id, std::optional<std::uintmax_t> offset, std::optional<int> wait)
+{
+	auto run = RunService::instance().getRun(user, job_id);
+
+	return create_log_reply(run, offset, wait);
+}
+
+zh::reply AdminController::job_rama_angles(const zh::scope &scope, const std::string &user, unsigned long job_id)
+{
+	auto run = RunService::instance().getRun(user, job_id);
+
+	return create_rama_angles_reply(scope, RamaAnglesService::runKey(run.user, run.id), run.getResultFile("data.json"));
 }
 
 zh::reply AdminController::handle_get_job_file(const zh::scope &scope, const std::string &user, unsigned long job_id, const std::string &file)
@@ -778,12 +922,19 @@ class DbController : public zh::html_controller
 	{
 		map_post("get", &DbController::handle_get, "pdb-id");
 
+		// The rendered entry tables, this is what the db/{id} page and the
+		// pdb-redo-result component show. {id}/data is the same as JSON,
+		// for API clients only.
 		map_get("entry", &DbController::handle_entry, "pdb-id", "attic");
 		map_post("entry", &DbController::handle_entry, "pdb-id", "attic");
 
 		map_get("update/{id}", &DbController::handle_update, "id");
 
-		map_get("{id}/zipped", &DbController::handle_zipped, "id");
+		map_get("query", &DbController::handle_query, "filter", "sort", "fields", "offset", "limit");
+
+		map_get("{id}/zipped", &DbController::handle_zipped, "id", "include", "exclude", "format");
+		map_get("{id}/rama-angles", &DbController::handle_rama_angles, "id");
+		map_get("{id}/data", &DbController::handle_data, "id", "attic");
 		map_get("{id}/{file}", &DbController::handle_file, "id", "file");
 
 		// since the uri class was added to libzeep:
@@ -791,7 +942,7 @@ class DbController : public zh::html_controller
 		map_get("{id}/wf/{file}", &DbController::handle_file_wf, "id", "file");
 		map_get("{id}/wc/{file}", &DbController::handle_file_wc, "id", "file");
 
-		map_get("{id}/attic/{attic}/zipped", &DbController::handle_zipped_attic, "id", "attic");
+		map_get("{id}/attic/{attic}/zipped", &DbController::handle_zipped_attic, "id", "attic", "include", "exclude", "format");
 		map_get("{id}/attic/{attic}/{file}", &DbController::handle_file_attic, "id", "file", "attic");
 
 		map_get("{id}", &DbController::handle_show, "id");
@@ -799,7 +950,10 @@ class DbController : public zh::html_controller
 
 	zh::reply handle_get(const zh::scope &scope, std::string pdbID);
 	zh::reply handle_entry(const zh::scope &scope, std::string pdbID, std::optional<std::string> attic);
+	zh::reply handle_data(const zh::scope &scope, std::string pdbID, std::optional<std::string> attic);
 	zh::reply handle_show(const zh::scope &scope, std::string pdbID);
+	zh::reply handle_query(const zh::scope &scope, const std::optional<std::string> &filter, const std::optional<std::string> &sort,
+		const std::optional<std::string> &fields, std::optional<std::size_t> offset, std::optional<std::size_t> limit);
 
 	zh::reply handle_update(const zh::scope &scope, std::string pdbID)
 	{
@@ -822,19 +976,34 @@ class DbController : public zh::html_controller
 		}
 	}
 
-	zh::reply handle_zipped(const zh::scope &scope, std::string pdbID)
+	zh::reply handle_zipped(const zh::scope &scope, std::string pdbID,
+		const std::optional<std::string> &include, const std::optional<std::string> &exclude,
+		const std::optional<std::string> &format)
 	{
 		zeep::to_lower(pdbID);
 
-		const auto &[is, name] = DataService::instance().getZipFile(pdbID);
+		auto archiveFormat = selectArchiveFormat(format, scope.get_request().get_header("Accept"));
+		const auto &[is, name] = DataService::instance().getZipFile(pdbID, {}, { include, exclude }, archiveFormat);
 
 		zh::reply rep{ zh::ok };
-		rep.set_content(is, "application/zip");
+		rep.set_content(is, archiveContentType(archiveFormat));
 		rep.set_header("content-disposition", "attachement; filename = \"" + name + '"');
 
 		return rep;
 	}
 
+	zh::reply handle_rama_angles(const zh::scope &scope, std::string pdbID)
+	{
+		zeep::to_lower(pdbID);
+
+		// the id is used as a path in the cache directory
+		const std::regex rx(R"([0-9][0-9a-z]{3,7})");
+		if (not std::regex_match(pdbID, rx))
+			throw zh::not_found;
+
+		return create_rama_angles_reply(scope, RamaAnglesService::entryKey(pdbID), DataService::instance().getFile(pdbID, "data.json"));
+	}
+
 	zh::reply handle_file_wo(const zh::scope &scope, std::string pdbID, std::string file)
 	{
 		return handle_file(scope, pdbID, fs::path("wo") / file);
@@ -872,14 +1041,17 @@ class DbController : public zh::html_controller
 		return result;
 	}
 
-	zh::reply handle_zipped_attic(const zh::scope &scope, std::string pdbID, const std::string &attic)
+	zh::reply handle_zipped_attic(const zh::scope &scope, std::string pdbID, const std::string &attic,
+		const std::optional<std::string> &include, const std::optional<std::string> &exclude,
+		const std::optional<std::string> &format)
 	{
 		zeep::to_lower(pdbID);
 
-		const auto &[is, name] = DataService::instance().getZipFile(pdbID, attic);
+		auto archiveFormat = selectArchiveFormat(format, scope.get_request().get_header("Accept"));
+		const auto &[is, name] = DataService::instance().getZipFile(pdbID, attic, { include, exclude }, archiveFormat);
 
 		zh::reply rep{ zh::ok };
-		rep.set_content(is, "application/zip");
+		rep.set_content(is, archiveContentType(archiveFormat));
 		rep.set_header("content-disposition", "attachement; filename = \"" + name + '"');
 
 		return rep;
@@ -900,6 +1072,25 @@ class DbController : public zh::html_controller
 		result.set_header("content-disposition", "attachement; filename = \"" + f.filename().string() + "\"");
 		return result;
 	}
+
+  private:
+	json create_entry(const std::string &pdbID, const std::optional<std::string> &attic);
+
+	// The rendered entry::tables of databank entries. These depend only on
+	// what the entry ETag is made of and on the templates, which are
+	// resources of the executable in release builds.
+
+	struct CachedEntry
+	{
+		std::string key;
+		std::string etag;
+		zh::reply reply;
+	};
+
+	static constexpr std::size_t kMaxCachedEntries = 128;
+
+	std::mutex m_cache_mutex;
+	std::list<CachedEntry> m_cache;	// most recently used first
 };
 
 zh::reply DbController::handle_get(const zh::scope &scope, std::string pdbID)
@@ -927,15 +1118,23 @@ zh::reply DbController::handle_show(const zh::scope &scope, std::string pdbID)
 
 	try
 	{
-		auto data = ds.getData(pdbID);
-		if (data)
+		// The page itself only needs these, the entry tables are fetched
+		// from db/entry. They come from the entry index when it is up to
+		// date for this entry, saving a parse of the whole data.json.
+		auto properties = ds.getProperties(pdbID, { "VERSION", "NOPDB", "NOSF" });
+		if (properties)
 		{
-			auto entry = create_entry_data(data, "/db/" + pdbID, ds.getFileList(pdbID));
+			std::optional<float> entryVersion;
+			if (not properties["VERSION"].is_null())
+				entryVersion = properties["VERSION"].as<float>();
 
-			entry["id"] = pdbID;
-			entry["dbEntry"] = true;
+			zeep::json::element entry{
+				{ "id", pdbID },
+				{ "dbEntry", true },
+				{ "data", std::move(properties) }
+			};
 
-			auto status = ds.getUpdateStatus(pdbID);
+			auto status = ds.getUpdateStatus(pdbID, entryVersion);
 			to_element(entry["status"], status);
 
 			sub.put("entry", entry);
@@ -950,14 +1149,14 @@ zh::reply DbController::handle_show(const zh::scope &scope, std::string pdbID)
 	{
 		try
 		{
-			auto data = ds.getData(pdbID, attic);
-			auto entry = create_entry_data(data, "/db/" + pdbID + "/attic/" + attic + '/', ds.getFileList(pdbID, attic));
+			// The update notice is not shown for attic entries
+			if (not fs::exists(ds.getFile(pdbID, "data.json", attic)))
+				throw zh::not_found;
 
-			entry["id"] = pdbID;
-			entry["dbEntry"] = true;
-
-			auto status = ds.getUpdateStatus(pdbID);
-			to_element(entry["status"], status);
+			zeep::json::element entry{
+				{ "id", pdbID },
+				{ "dbEntry", true }
+			};
 
 			sub.put("entry", entry);
 			sub.put("attic", attic);
@@ -975,22 +1174,129 @@ zh::reply DbController::handle_show(const zh::scope &scope, std::string pdbID)
 	return get_template_processor().create_reply_from_template("why-not", sub);
 }
 
-zh::reply DbController::handle_entry(const zh::scope &scope, std::string pdbID, std::optional<std::string> attic)
+json DbController::create_entry(const std::string &pdbID, const std::optional<std::string> &attic)
 {
-	zeep::to_lower(pdbID);
+	auto &ds = DataService::instance();
 
-	auto dataJsonFile = DataService::instance().getFile(pdbID, "data.json", attic);
-	std::ifstream dataJson(dataJsonFile);
+	std::ifstream dataJson(ds.getFile(pdbID, "data.json", attic));
+	if (not dataJson.is_open())
+		throw zh::not_found;
 
 	zeep::json::element data;
 	zeep::json::parse_json(dataJson, data);
 
-	auto entry = create_entry_data(data, "/db/" + pdbID, DataService::instance().getFileList(pdbID));
+	auto entry = attic
+		? create_entry_data(data, "/db/" + pdbID + "/attic/" + *attic + '/', ds.getFileList(pdbID, attic))
+		: create_entry_data(data, "/db/" + pdbID, ds.getFileList(pdbID), {}, "/db/" + pdbID + "/rama-angles");
+
+	entry["id"] = pdbID;
+	entry["dbEntry"] = true;
+
+	return entry;
+}
+
+zh::reply DbController::handle_entry(const zh::scope &scope, std::string pdbID, std::optional<std::string> attic)
+{
+	zeep::to_lower(pdbID);
+
+	if (attic and attic->empty())
+		attic.reset();
+
+#ifdef NDEBUG
+	auto etag = create_entry_etag("entry", pdbID, attic);
+
+	zh::reply reply(zh::ok);
+	if (check_etag(scope, reply, etag))
+		return reply;
+
+	auto key = attic ? pdbID + "/attic/" + *attic : pdbID;
+
+	{
+		std::unique_lock lock(m_cache_mutex);
+
+		for (auto i = m_cache.begin(); i != m_cache.end(); ++i)
+		{
+			if (i->key != key)
+				continue;
+
+			if (i->etag == etag)
+			{
+				m_cache.splice(m_cache.begin(), m_cache, i);
+				return i->reply;
+			}
+
+			m_cache.erase(i);
+			break;
+		}
+	}
+#endif
 
 	zh::scope sub(scope);
-	sub.put("entry", entry);
+	sub.put("entry", create_entry(pdbID, attic));
 
-	return get_template_processor().create_reply_from_template("entry::tables", sub);
+	auto result = get_template_processor().create_reply_from_template("entry::tables", sub);
+
+#ifdef NDEBUG
+	result.set_header("ETag", etag);
+	result.set_header("Cache-Control", "no-cache");
+
+	std::unique_lock lock(m_cache_mutex);
+
+	m_cache.push_front({ key, etag, result });
+	if (m_cache.size() > kMaxCachedEntries)
+		m_cache.pop_back();
+#endif
+
+	return result;
+}
+
+zh::reply DbController::handle_data(const zh::scope &scope, std::string pdbID, std::optional<std::string> attic)
+{
+	zeep::to_lower(pdbID);
+
+	if (attic and attic->empty())
+		attic.reset();
+
+	zh::reply reply(zh::ok);
+
+	if (not check_etag(scope, reply, create_entry_etag("data", pdbID, attic)))
+		reply.set_content(create_entry(pdbID, attic));
+
+	return reply;
+}
+
+zh::reply DbController::handle_query(const zh::scope &scope, const std::optional<std::string> &filter, const std::optional<std::string> &sort,
+	const std::optional<std::string> &fields, std::optional<std::size_t> offset, std::optional<std::size_t> limit)
+{
+	zh::reply reply(zh::ok);
+
+	try
+	{
+		EntryQuery query;
+
+		query.filter = filter.value_or("");
+		query.sort = sort.value_or("");
+		if (fields)
+			zeep::split(query.fields, *fields, ",");
+		query.offset = offset.value_or(0);
+		query.limit = limit.value_or(query.limit);
+
+		reply.set_content(EntryIndex::instance().query(query));
+	}
+	catch (const EntryIndexUnavailable &e)
+	{
+		// the first build is still running, try again later
+		reply.set_content(json({ { "error", e.what() } }));
+		reply.set_status(zh::service_unavailable);
+		reply.set_header("Retry-After", "60");
+	}
+	catch (const std::exception &e)
+	{
+		reply.set_content(json({ { "error", e.what() } }));
+		reply.set_status(zh::bad_request);
+	}
+
+	return reply;
 }
 
 // --------------------------------------------------------------------
@@ -1049,6 +1355,19 @@ int a_main(int argc, char *const argv[])
 		mcfp::make_option<std::string>("pdb-redo-tools-dir", "Directory containing PDB-REDO tools (and files)"),
 		mcfp::make_option<std::string>("pdb-redo-services-dir", "Directory containing PDB-REDO server data"),
 		mcfp::make_option<std::string>("runs-dir", "Directory containing PDB-REDO server run directories"),
+		mcfp::make_option<int>("housekeeping-interval", 10, "Interval in seconds between updates of the run registry"),
+		mcfp::make_option<std::uintmax_t>("reaper-rate", 50, "Maximum rate in MB per second at which deleted runs are removed from disk"),
+		mcfp::make_option("no-preflight", "Do not check the input files when a run is submitted"),
+		mcfp::make_option<int>("upload-lifetime", 24, "Number of hours after which unused uploads are removed"),
+		mcfp::make_option<int>("max-active-runs", 0, "Maximum number of runs handed over to the pipeline at the same time, zero means no limit"),
+		mcfp::make_option<int>("max-active-runs-per-user", 0, "Maximum number of runs per user handed over to the pipeline at the same time, zero means no limit"),
+		mcfp::make_option<std::uintmax_t>("user-quota", 0, "Maximum disk space in MB used by the runs of a single user, zero means no limit"),
+		mcfp::make_option<int>("max-batch-size", 25, "Maximum number of runs submitted in a single batch, zero means no limit"),
+		mcfp::make_option<int>("retention-days", 0, "Remove ended runs older than this number of days, zero means keep forever"),
+		mcfp::make_option<int>("retention-days-stopped", 0, "Remove stopped runs older than this number of days, zero means keep forever"),
+		mcfp::make_option<int>("retention-max-runs-per-user", 0, "Remove the oldest finished runs of users that have more finished runs than this, active and waiting runs do not count, zero means no limit"),
+		mcfp::make_option<int>("retention-batch-size", 10, "Maximum number of runs removed by the retention policy per housekeeping interval"),
+		mcfp::make_option("retention-dry-run", "Do not remove runs, only report what the retention policy would remove"),
 		mcfp::make_option<std::string>("ccp4-dir", "CCP4 directory, if not specified the environmental variable CCP4 will be used (and should be available)"),
 		mcfp::make_option<std::string>("address", "0.0.0.0", "External address"),
 		mcfp::make_option<uint16_t>("port", 10339, "Port to listen to"),
@@ -1061,6 +1380,14 @@ int a_main(int argc, char *const argv[])
 		mcfp::make_option<std::string>("db-password", "Database password"),
 		mcfp::make_option<std::string>("admin", "Administrators, list of usernames separated by comma"),
 		mcfp::make_option<std::string>("secret", "Secret value, used in signing access tokens"),
+		mcfp::make_option<std::string>("download-secret", "Secret used to sign download URLs, by default the value of secret is used"),
+		mcfp::make_option<std::string>("download-signing", "hmac", "Signature used in download URLs, either hmac or nginx for the nginx secure_link module, which signs the decoded path ($uri)"),
+		mcfp::make_option<int>("download-url-max-age", 168, "Maximum number of hours a signed download URL is valid"),
+		mcfp::make_option<int>("zstd-level", 3, "Compression level for tar.zst downloads"),
+		mcfp::make_option<int>("zstd-threads", 0, "Number of threads used to compress tar.zst downloads, zero means one per core"),
+		mcfp::make_option<std::string>("entry-index", "File containing the index of all databank entries, default is entry-index.bin in the pdb-redo-services-dir"),
+		mcfp::make_option<int>("entry-index-interval", 60, "Interval in minutes between updates of the entry index, zero means this server does not update it"),
+		mcfp::make_option<std::string>("rama-angles-cache", "Directory for the encoded rama-angles of entries and runs, default is rama-angles in the pdb-redo-services-dir"),
 
 		mcfp::make_option<std::string>("smtp-user", "user name of SMTP server used for resetting password"),
 		mcfp::make_option<std::string>("smtp-password", "password of SMTP server used for resetting password"),
@@ -1157,8 +1484,16 @@ Command should be either:
 		if (config.has("context"))
 			context = config.get<std::string>("context");
 
+		SignedURLService::init(secret, context);
+
+		ArchiveStreambuf::setZstdOptions(config.get<int>("zstd-level"), config.get<int>("zstd-threads"));
+
 		zh::daemon server([secret, context, &config]()
 			{
+			// The background threads are started here, in the process that serves the requests
+			RunService::instance().start();
+			EntryIndex::instance().start();
+
 			auto sc = new zh::security_context(secret, UserService::instance());
 			sc->add_rule("/admin", { "ADMIN" });
 			sc->add_rule("/admin/**", { "ADMIN" });
@@ -1195,6 +1530,7 @@ Command should be either:
 			s->add_controller(new RootController(config.get("pdb-redo-db-dir")));
 			s->add_controller(new UserHTMLController());
 			s->add_controller(new AdminController());
+			s->add_controller(new DbRESTController());
 			s->add_controller(new DbController());
 			// s->add_controller(new TokenRESTController());
 			s->add_controller(new APIRESTController_v1());
@@ -1203,6 +1539,7 @@ Command should be either:
 			s->add_controller(new GFXRESTController());
 
 			s->add_controller(new JobController());
+			s->add_controller(new SignedDownloadController());
 
 			return s; },
 			kProjectName);
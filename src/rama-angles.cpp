@@ -0,0 +1,378 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "rama-angles.hpp"
+
+#include <mcfp.hpp>
+
+#include <zeep/http/reply.hpp>
+#include <zeep/json/parser.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+enum RamaClass : uint8_t
+{
+	kNoClass,
+	kFavored,
+	kAllowed,
+	kOutlier
+};
+
+const uint8_t kCisFlag = 1 << 2;
+
+template <typename T>
+void append(std::string &s, T v)
+{
+	char b[sizeof(T)];
+	std::memcpy(b, &v, sizeof(T));
+	s.append(b, sizeof(T));
+}
+
+template <typename T>
+void append(std::string &s, const std::vector<T> &v)
+{
+	for (auto i : v)
+		append(s, i);
+}
+
+int16_t quantize(zeep::json::element &angle)
+{
+	if (not angle.is_number())
+		return RamaAnglesService::kMissingAngle;
+	return static_cast<int16_t>(std::lround(angle.as<double>() * 100));
+}
+
+uint8_t flags(zeep::json::element &residue)
+{
+	uint8_t result = kNoClass;
+
+	auto rama = residue["rama"].is_string() ? residue["rama"].as<std::string>() : "";
+	if (rama == "Favored")
+		result = kFavored;
+	else if (rama == "Allowed")
+		result = kAllowed;
+	else if (rama == "OUTLIER")
+		result = kOutlier;
+
+	if (residue["cis"].is_boolean() and residue["cis"].as<bool>())
+		result |= kCisFlag;
+
+	return result;
+}
+
+class StringTable
+{
+  public:
+	uint32_t operator()(zeep::json::element &e)
+	{
+		std::string s;
+		if (e.is_string())
+			s = e.as<std::string>();
+		else if (e.is_number())
+			s = std::to_string(e.as<int64_t>());
+
+		auto i = m_index.find(s);
+		if (i == m_index.end())
+		{
+			i = m_index.emplace(s, static_cast<uint32_t>(m_strings.size())).first;
+			m_strings.push_back(s);
+		}
+		return i->second;
+	}
+
+	void write(std::string &s) const
+	{
+		uint32_t offset = 0;
+		for (auto &str : m_strings)
+		{
+			append(s, offset);
+			offset += str.length();
+		}
+		append(s, offset);
+
+		for (auto &str : m_strings)
+			s += str;
+
+		s.append((4 - offset % 4) % 4, '\0');
+	}
+
+	uint32_t count() const { return m_strings.size(); }
+
+	uint32_t dataSize() const
+	{
+		uint32_t result = 0;
+		for (auto &str : m_strings)
+			result += str.length();
+		return result;
+	}
+
+  private:
+	std::map<std::string, uint32_t> m_index;
+	std::vector<std::string> m_strings;
+};
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+RamaAnglesService &RamaAnglesService::instance()
+{
+	static RamaAnglesService s_instance;
+	return s_instance;
+}
+
+RamaAnglesService::RamaAnglesService()
+{
+	auto &config = mcfp::config::instance();
+
+	if (config.has("rama-angles-cache"))
+		m_cache_dir = config.get<std::string>("rama-angles-cache");
+	else
+		m_cache_dir = fs::path(config.get<std::string>("pdb-redo-services-dir")) / "rama-angles";
+}
+
+RamaAnglesService::RamaAnglesService(const fs::path &cacheDir)
+	: m_cache_dir(cacheDir)
+{
+}
+
+std::string RamaAnglesService::entryKey(const std::string &pdbID)
+{
+	return "db/" + pdbID.substr(1, 2) + '/' + pdbID;
+}
+
+std::string RamaAnglesService::runKey(const std::string &user, unsigned long runID)
+{
+	return "runs/" + user + '/' + std::to_string(runID);
+}
+
+fs::path RamaAnglesService::getFile(const std::string &key) const
+{
+	return m_cache_dir / (key + ".bin");
+}
+
+// The cached file is up to date when it is newer than data.json and was
+// written by this version of the encoder
+bool RamaAnglesService::isUpToDate(const fs::path &file, const fs::path &dataJson)
+{
+	std::error_code ec;
+	auto mtime = fs::last_write_time(file, ec);
+	if (ec)
+		return false;
+
+	auto dataMTime = fs::last_write_time(dataJson, ec);
+	if (ec or mtime < dataMTime)
+		return false;
+
+	char header[8];
+	std::ifstream in(file, std::ios::binary);
+	if (not in.read(header, sizeof(header)) or std::memcmp(header, "RAMA", 4) != 0)
+		return false;
+
+	uint32_t version;
+	std::memcpy(&version, header + 4, sizeof(version));
+	return version == kVersion;
+}
+
+// Write to a temporary file with a unique name first, readers never see a
+// partial file and concurrent writers of the same key do not mix
+void RamaAnglesService::store(const fs::path &file, const std::string &data)
+{
+	fs::create_directories(file.parent_path());
+
+	std::random_device rng;
+	auto tmp = file;
+	tmp += ".tmp-" + std::to_string(rng());
+
+	std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+	if (not out.is_open())
+		throw std::runtime_error("Could not create " + tmp.string());
+
+	out.write(data.data(), data.size());
+	out.close();
+
+	std::error_code ec;
+	if (not out)
+	{
+		fs::remove(tmp, ec);
+		throw std::runtime_error("Could not write " + tmp.string());
+	}
+
+	fs::rename(tmp, file, ec);
+	if (ec)
+	{
+		fs::remove(tmp, ec);
+		throw std::runtime_error("Could not rename " + tmp.string());
+	}
+}
+
+void RamaAnglesService::update(const std::string &key, const fs::path &dataJson, zeep::json::element &data)
+{
+	try
+	{
+		auto &rama = data["rama-angles"];
+		auto file = getFile(key);
+		if (rama.is_array() and not isUpToDate(file, dataJson))
+			store(file, encode(rama));
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << "Could not store the rama-angles for " << dataJson << ": " << ex.what() << std::endl;
+	}
+}
+
+void RamaAnglesService::remove(const std::string &key)
+{
+	std::error_code ec;
+	fs::remove(getFile(key), ec);
+}
+
+std::shared_ptr<const RamaAngles> RamaAnglesService::get(const std::string &key, const fs::path &dataJson)
+{
+	std::error_code ec;
+	if (not fs::exists(dataJson, ec))
+		throw zeep::http::not_found;
+
+	auto file = getFile(key);
+	auto angles = std::make_shared<RamaAngles>();
+
+	if (isUpToDate(file, dataJson))
+	{
+		std::ifstream in(file, std::ios::binary);
+		std::ostringstream s;
+		s << in.rdbuf();
+		angles->data = s.str();
+	}
+	else
+	{
+		std::ifstream in(dataJson);
+		if (not in.is_open())
+			throw zeep::http::not_found;
+
+		zeep::json::element data;
+		zeep::json::parse_json(in, data);
+
+		auto &rama = data["rama-angles"];
+		if (not rama.is_array())
+			throw zeep::http::not_found;
+
+		angles->data = encode(rama);
+
+		try
+		{
+			store(file, angles->data);
+		}
+		catch (const std::exception &ex)
+		{
+			// serve it anyway, it is encoded again next time
+			std::cerr << "Could not store the rama-angles for " << dataJson << ": " << ex.what() << std::endl;
+		}
+	}
+
+	// The contents only change along with data.json
+	auto mtime = fs::last_write_time(dataJson, ec);
+
+	std::ostringstream etag;
+	etag << "\"rama-" << kVersion << '-' << std::hex << mtime.time_since_epoch().count() << '-' << angles->data.size() << '"';
+	angles->etag = etag.str();
+
+	return angles;
+}
+
+std::string RamaAnglesService::encode(zeep::json::element &rama)
+{
+	StringTable strings;
+
+	std::vector<uint32_t> chain, compound, number;
+	std::vector<int16_t> origPhi, origPsi, redoPhi, redoPsi;
+	std::vector<uint8_t> origFlags, redoFlags;
+
+	// Only the first model is shown in the plot
+	for (auto &entity : rama)
+	{
+		for (auto &ch : entity["chains"])
+		{
+			auto &models = ch["models"];
+			if (not models.is_array() or models.empty())
+				continue;
+
+			for (auto &residue : models.front()["residues"])
+			{
+				chain.push_back(strings(ch["asym_id"]));
+				compound.push_back(strings(residue["compound_id"]));
+				number.push_back(strings(residue["seq_id"]));
+
+				auto &orig = residue["orig"];
+				auto &redo = residue["redo"];
+
+				origPhi.push_back(quantize(orig["phi"]));
+				origPsi.push_back(quantize(orig["psi"]));
+				redoPhi.push_back(quantize(redo["phi"]));
+				redoPsi.push_back(quantize(redo["psi"]));
+
+				origFlags.push_back(flags(orig));
+				redoFlags.push_back(flags(redo));
+			}
+		}
+	}
+
+	std::string result;
+	result.reserve(20 + 4 * (strings.count() + 1) + strings.dataSize() + 3 + 22 * chain.size());
+
+	result.append("RAMA", 4);
+	append(result, kVersion);
+	append(result, static_cast<uint32_t>(chain.size()));
+	append(result, strings.count());
+	append(result, strings.dataSize());
+
+	strings.write(result);
+
+	append(result, chain);
+	append(result, compound);
+	append(result, number);
+	append(result, origPhi);
+	append(result, origPsi);
+	append(result, redoPhi);
+	append(result, redoPsi);
+	append(result, origFlags);
+	append(result, redoFlags);
+
+	return result;
+}
@@ -0,0 +1,104 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <zeep/json/element.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+// --------------------------------------------------------------------
+// The rama-angles of an entry in a compact binary form, for the
+// Kleywegt-like plot. All values are little endian:
+//
+//	header		char[4] "RAMA", uint32 version, uint32 residue count N,
+//				uint32 string count S, uint32 string data size
+//	strings		uint32[S + 1] offsets, followed by the UTF-8 data, padded
+//				with zeros to a multiple of four bytes
+//	residues	uint32[N] chain, uint32[N] compound and uint32[N] residue
+//				number, all three indices in the string table
+//				int16[N] phi and int16[N] psi for orig and then for redo, in
+//				hundredths of a degree, kMissingAngle when undefined
+//				uint8[N] flags for orig and then for redo, the rama class in
+//				the lower two bits and the cis flag in bit 2
+//
+// webapp/rama-angles.js contains the decoder. The encoded form is stored
+// in a cache directory owned by this server, one file per key. Keys are
+// made by entryKey and runKey, the data directories are never written to.
+
+struct RamaAngles
+{
+	std::string data;
+	std::string etag;
+};
+
+class RamaAnglesService
+{
+  public:
+	static RamaAnglesService &instance();
+
+	// A service storing its files in cacheDir. The server uses instance(),
+	// which takes the directory from the configuration.
+	RamaAnglesService(const std::filesystem::path &cacheDir);
+
+	// The encoded rama-angles of the data.json file, read from the cached
+	// file for key. That file is created first when it is missing or out
+	// of date. Throws not_found when there are no rama-angles.
+	std::shared_ptr<const RamaAngles> get(const std::string &key, const std::filesystem::path &dataJson);
+
+	// Store the encoded rama-angles of dataJson, whose contents are in data,
+	// unless the cached file is up to date already. Used when a run has
+	// ended and when the entry index is built, failures are only reported.
+	void update(const std::string &key, const std::filesystem::path &dataJson, zeep::json::element &data);
+
+	// Remove the cached file for key, when a run is deleted
+	void remove(const std::string &key);
+
+	// The cached file for key
+	std::filesystem::path getFile(const std::string &key) const;
+
+	static std::string entryKey(const std::string &pdbID);
+	static std::string runKey(const std::string &user, unsigned long runID);
+
+	static std::string encode(zeep::json::element &rama);
+
+	static constexpr uint32_t kVersion = 1;
+	static constexpr int16_t kMissingAngle = INT16_MIN;
+
+  private:
+	RamaAnglesService();
+
+	RamaAnglesService(const RamaAnglesService &) = delete;
+	RamaAnglesService &operator=(const RamaAnglesService &) = delete;
+
+	static bool isUpToDate(const std::filesystem::path &file, const std::filesystem::path &dataJson);
+	static void store(const std::filesystem::path &file, const std::string &data);
+
+	std::filesystem::path m_cache_dir;
+};
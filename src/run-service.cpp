@@ -24,16 +24,32 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <atomic>
 #include <cassert>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <queue>
+#include <random>
 #include <regex>
 #include <stdexcept>
+#include <thread>
+
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include <zeep/streambuf.hpp>
 #include <zeep/json/parser.hpp>
 
+#include <mcfp.hpp>
+
+#include "preflight.hpp"
+#include "rama-angles.hpp"
+#include "prsm-db-connection.hpp"
 #include "run-service.hpp"
+#include "upload-service.hpp"
 #include "user-service.hpp"
 #include "zip-support.hpp"
 
@@ -95,8 +111,132 @@ RunStatus from_string(const std::string &status)
 
 static const std::regex kRunDirNameRx(R"([0-9]{10})");
 
+// The keys for the advisory locks held by the process doing the housekeeping
+const int64_t
+	kHousekeepingLockKey = 0x7072736d64,
+	kReaperLockKey = 0x7072736d65;
+
+// Deleted runs are moved here, inside the runs directory to keep the rename atomic
+const char kTrashDir[] = ".trash";
+const char kUploadDir[] = ".uploads";
+
+// The states in which a run takes up a slot in the pipeline
+const char kActiveStates[] = "('starting', 'queued', 'running', 'stopping')";
+
+const char kSelectRuns[] = R"(SELECT r.id, u.name AS user, r.status, r.has_image, r.created,
+		   r.started, r.running, r.ended, r.input, r.score, r.size, r.rank
+	  FROM redo.run r JOIN redo.user u ON r.user_id = u.id)";
+
+static std::string runDirName(unsigned long runID)
+{
+	std::ostringstream s;
+	s << std::setw(10) << std::setfill('0') << runID;
+	return s.str();
+}
+
+static std::chrono::time_point<std::chrono::system_clock> fileTime(const fs::path &file)
+{
+	using namespace std::chrono;
+
+	auto ft = fs::last_write_time(file);
+	return time_point_cast<system_clock::duration>(ft - decltype(ft)::clock::now() + system_clock::now());
+}
+
+// The number of bytes used by the files in a directory
+static std::uintmax_t directorySize(const fs::path &dir)
+{
+	std::uintmax_t result = 0;
+	std::error_code ec;
+
+	for (auto i = fs::recursive_directory_iterator(dir, ec); not ec and i != fs::recursive_directory_iterator(); i.increment(ec))
+	{
+		if (i->is_regular_file(ec) and not i->is_symlink(ec))
+		{
+			auto size = i->file_size(ec);
+			if (not ec)
+				result += size;
+		}
+	}
+
+	return result;
+}
+
+static std::string sqlTimestamp(const std::optional<std::chrono::time_point<std::chrono::system_clock>> &t)
+{
+	using namespace std::chrono;
+
+	if (not t.has_value())
+		return "NULL";
+
+	return "to_timestamp(" + std::to_string(duration_cast<milliseconds>(t->time_since_epoch()).count() / 1000.0) + ")";
+}
+
+template <typename T>
+std::string sqlJSON(pqxx::transaction_base &tx, const T &v)
+{
+	zeep::json::element e;
+	to_element(e, v);
+
+	std::ostringstream s;
+	s << e;
+
+	return tx.quote(s.str()) + "::jsonb";
+}
+
+// Collect the runs found in the directory of a single user, unsorted
+static std::vector<Run> collectRuns(const fs::path &dir, const std::string &username)
+{
+	std::vector<Run> result;
+
+	for (auto i = fs::directory_iterator(dir); i != fs::directory_iterator(); ++i)
+	{
+		if (not i->is_directory())
+			continue;
+
+		if (not std::regex_match(i->path().filename().string(), kRunDirNameRx))
+			continue;
+
+		if (not fs::is_directory(i->path() / "input"))
+			continue;
+
+		try
+		{
+			result.push_back(Run::create(i->path(), username));
+		}
+		catch (const std::exception &e)
+		{
+			std::cerr << e.what() << std::endl;
+		}
+	}
+
+	return result;
+}
+
 // --------------------------------------------------------------------
 
+// The status of a run as told by its flag files, without reading anything else
+RunStatus Run::getStatus(const fs::path &dir)
+{
+	RunStatus status = RunStatus::REGISTERED;
+
+	if (fs::exists(dir / "deletingProcess.txt"))
+		status = RunStatus::DELETING;
+	else if (fs::exists(dir / "processEnded.txt"))
+		status = RunStatus::ENDED;
+	else if (fs::exists(dir / "processStopped.txt"))
+		status = RunStatus::STOPPED;
+	else if (fs::exists(dir / "stoppingProcess.txt"))
+		status = RunStatus::STOPPING;
+	else if (fs::exists(dir / "processRunning.txt"))
+		status = RunStatus::RUNNING;
+	else if (fs::exists(dir / "rank.txt"))
+		status = RunStatus::QUEUED;
+	else if (fs::exists(dir / "startingProcess.txt"))
+		status = RunStatus::STARTING;
+
+	return status;
+}
+
 Run Run::create(const fs::path &dir, const std::string &username)
 {
 	using namespace std::chrono;
@@ -111,27 +251,39 @@ Run Run::create(const fs::path &dir, const std::string &username)
 	if (fs::exists(dir / "startingProcess.txt"))
 	{
 		run.status = RunStatus::STARTING;
-
-		auto ft = fs::last_write_time(dir / "startingProcess.txt");
-		run.started = time_point_cast<system_clock::duration>(ft - decltype(ft)::clock::now() + system_clock::now());
+		run.started = fileTime(dir / "startingProcess.txt");
 	}
 	if (fs::exists(dir / "rank.txt"))
+	{
 		run.status = RunStatus::QUEUED;
+
+		int rank;
+		std::ifstream rankFile(dir / "rank.txt");
+		if (rankFile >> rank)
+			run.rank = rank;
+	}
 	if (fs::exists(dir / "processRunning.txt"))
+	{
 		run.status = RunStatus::RUNNING;
+		run.running = fileTime(dir / "processRunning.txt");
+	}
 	if (fs::exists(dir / "stoppingProcess.txt"))
 		run.status = RunStatus::STOPPING;
 	if (fs::exists(dir / "processStopped.txt"))
+	{
 		run.status = RunStatus::STOPPED;
+		run.ended = fileTime(dir / "processStopped.txt");
+	}
 	if (fs::exists(dir / "processEnded.txt"))
+	{
 		run.status = RunStatus::ENDED;
+		run.ended = fileTime(dir / "processEnded.txt");
+	}
 	if (fs::exists(dir / "deletingProcess.txt"))
 		run.status = RunStatus::DELETING;
 
 	run.has_image = fs::exists(dir / "pdbin.png");
-
-	auto ft = fs::last_write_time(dir);
-    run.date = time_point_cast<system_clock::duration>(ft - decltype(ft)::clock::now() + system_clock::now());
+	run.date = fileTime(dir);
 
 	if (fs::is_directory(dir / "input"))
 	{
@@ -185,6 +337,79 @@ Run Run::create(const fs::path &dir, const std::string &username)
 				v.nucleicAcidGeometry->position = 4;
 		}
 
+		std::ifstream dataFile(dir / "output" / "data.json");
+		if (dataFile.is_open())
+		{
+			try
+			{
+				zeep::json::element data;
+				zeep::json::parse_json(dataFile, data);
+
+				// the plot of a finished run is served from this file
+				RamaAnglesService::instance().update(RamaAnglesService::runKey(username, run.id), dir / "output" / "data.json", data);
+
+				auto &properties = data["properties"];
+
+				try
+				{
+					v.percentiles = StatsService::instance().getPercentiles(properties);
+				}
+				catch (const std::exception &ex)
+				{
+					std::cerr << "Could not calculate percentiles for run " << run.id << ": " << ex.what() << std::endl;
+				}
+
+				v.classes = EntryClasses::create(properties, v.percentiles);
+			}
+			catch (const std::exception &ex)
+			{
+				std::cerr << "Could not read data.json of run " << run.id << ": " << ex.what() << std::endl;
+			}
+		}
+
+		run.score = v;
+	}
+
+	return run;
+}
+
+Run Run::create(const pqxx::row &row, const fs::path &runsDir)
+{
+	Run run;
+
+	run.id = row.at("id").as<uint32_t>();
+	run.user = row.at("user").as<std::string>();
+	run.m_dir = runsDir / run.user / runDirName(run.id);
+
+	run.status = zeep::value_serializer<RunStatus>::from_string(row.at("status").as<std::string>());
+	run.has_image = row.at("has_image").as<bool>();
+	run.date = parse_timestamp(row.at("created").as<std::string>());
+	run.size = row.at("size").as<std::uintmax_t>();
+
+	if (not row.at("rank").is_null())
+		run.rank = row.at("rank").as<int>();
+
+	if (not row.at("started").is_null())
+		run.started = parse_timestamp(row.at("started").as<std::string>());
+	if (not row.at("running").is_null())
+		run.running = parse_timestamp(row.at("running").as<std::string>());
+	if (not row.at("ended").is_null())
+		run.ended = parse_timestamp(row.at("ended").as<std::string>());
+
+	if (not row.at("input").is_null())
+	{
+		zeep::json::element input;
+		zeep::json::parse_json(row.at("input").as<std::string>(), input);
+		from_element(input, run.input);
+	}
+
+	if (not row.at("score").is_null())
+	{
+		zeep::json::element score;
+		zeep::json::parse_json(row.at("score").as<std::string>(), score);
+
+		Score v;
+		from_element(score, v);
 		run.score = v;
 	}
 
@@ -221,39 +446,119 @@ std::filesystem::path Run::getResultFile(const std::string& file)
 	return m_dir / "output" / file;
 }
 
-std::filesystem::path Run::getImageFile()
+// Wait for a change in any of the directories, returns false on timeout
+static bool waitForChange(const std::vector<fs::path> &dirs, std::chrono::milliseconds timeout)
 {
-	if (not fs::exists(m_dir))
-		throw std::runtime_error("Run does not exist");
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0)
+		throw std::runtime_error("Could not create inotify instance: " + std::string(strerror(errno)));
 
-	return m_dir / "pdbin.png";
+	for (auto &dir : dirs)
+		inotify_add_watch(fd, dir.c_str(), IN_MODIFY | IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO);
+
+	pollfd pfd{ fd, POLLIN, 0 };
+	int r = poll(&pfd, 1, timeout.count());
+
+	close(fd);
+
+	return r > 0;
+}
+
+LogChunk Run::getLog(std::uintmax_t offset, std::chrono::seconds wait)
+{
+	const std::size_t kMaxLogChunk = 1024 * 1024;
+
+	// There are only a few server threads, do not keep one waiting long.
+	// Clients are expected to poll instead.
+	wait = std::clamp(wait, std::chrono::seconds(0), std::chrono::seconds(2));
+
+	auto file = getResultFile("process.log");
+	auto deadline = std::chrono::steady_clock::now() + wait;
+
+	LogChunk result;
+
+	for (;;)
+	{
+		// the flag files tell us the current status
+		result.status = getStatus(m_dir);
+		bool ended = result.status == RunStatus::ENDED or result.status == RunStatus::STOPPED;
+
+		std::error_code ec;
+		auto size = fs::file_size(file, ec);
+		if (ec)
+			size = 0;
+
+		// the log was restarted
+		if (offset > size)
+			offset = 0;
+
+		if (size > offset)
+		{
+			std::ifstream in(file, std::ios::binary);
+			in.seekg(offset);
+
+			result.text.resize(std::min<std::uintmax_t>(size - offset, kMaxLogChunk));
+			in.read(result.text.data(), result.text.size());
+			result.text.resize(in.gcount());
+
+			// do not return partial lines, unless the line is very long
+			if (offset + result.text.size() < size)
+			{
+				auto eol = result.text.rfind('\n');
+				if (eol != std::string::npos)
+					result.text.resize(eol + 1);
+			}
+
+			offset += result.text.size();
+		}
+
+		result.offset = offset;
+		result.finished = ended and offset >= size;
+
+		if (not result.text.empty() or ended)
+			break;
+
+		auto now = std::chrono::steady_clock::now();
+		if (now >= deadline)
+			break;
+
+		waitForChange({ m_dir, m_dir / "output" },
+			std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now));
+	}
+
+	return result;
 }
 
-std::tuple<std::istream *, std::string> Run::getZippedResultFile()
+std::filesystem::path Run::getImageFile()
 {
 	if (not fs::exists(m_dir))
 		throw std::runtime_error("Run does not exist");
 
-	std::ostringstream s;
-	s << std::setw(10) << std::setfill('0') << id;
+	return m_dir / "pdbin.png";
+}
 
+void Run::addResultFiles(ArchiveStream &zs, const fs::path &dir, const FileSelection &selection)
+{
 	fs::path output = m_dir / "output";
-	fs::path d(s.str());
-
-	if (not fs::exists(output))
-		throw std::runtime_error("Result directory does not exist");
 
-	ZipWriter zw;
-
-	for (auto f : fs::recursive_directory_iterator(output))
+	for (auto &f : getResultFileList())
 	{
-		if (not f.is_regular_file())
-			continue;
-		
-		zw.add(f.path(), (d / fs::relative(f.path(), output)).string());
+		if (selection(f))
+			zs.add(output / f, dir / f);
 	}
+}
+
+std::tuple<std::istream *, std::string> Run::getZippedResultFile(const FileSelection &selection, ArchiveFormat format)
+{
+	auto name = runDirName(id);
+
+	std::unique_ptr<ArchiveStream> zs(new ArchiveStream(format));
+	addResultFiles(*zs, name, selection);
 
-	return { zw.finish(), s.str() + ".zip" };
+	if (zs->empty())
+		throw std::runtime_error("No result files match the selection");
+
+	return { zs.release(), name + archiveExtension(format) };
 }
 
 // --------------------------------------------------------------------
@@ -263,6 +568,21 @@ std::unique_ptr<RunService> RunService::s_instance;
 RunService::RunService(const std::string &runsDir)
 	: m_runsdir(runsDir)
 {
+	auto &config = mcfp::config::instance();
+
+	m_housekeepingInterval = std::chrono::seconds(config.get<int>("housekeeping-interval"));
+	m_reaperRate = config.get<std::uintmax_t>("reaper-rate") * 1024 * 1024;
+	m_userQuota = config.get<std::uintmax_t>("user-quota") * 1024 * 1024;
+	m_maxBatchSize = config.get<int>("max-batch-size");
+	m_maxActive = config.get<int>("max-active-runs");
+	m_maxActivePerUser = config.get<int>("max-active-runs-per-user");
+
+	m_retention.days = config.get<int>("retention-days");
+	m_retention.stoppedDays = config.get<int>("retention-days-stopped");
+	m_retention.maxRunsPerUser = config.get<int>("retention-max-runs-per-user");
+	m_retention.batchSize = std::max(config.get<int>("retention-batch-size"), 1);
+	m_retention.dryRun = config.has("retention-dry-run");
+
 	zeep::value_serializer<RunStatus>::instance("RunStatus")
 		("undefined", RunStatus::UNDEFINED)
 		("registered", RunStatus::REGISTERED)
@@ -288,177 +608,700 @@ RunService &RunService::instance()
 	return *s_instance;
 }
 
-Run RunService::submit(const std::string &user, const zh::file_param &pdb, const zh::file_param &mtz,
-	const zh::file_param &restraints, const zh::file_param &sequence, const zeep::json::element &params)
+RunService::~RunService()
 {
-	using namespace std::literals;
-
-	const std::regex rx("[-a-zA-Z0-9+_().]+");
-
-	// create user directory first, if needed
-	auto userDir = m_runsdir / user;
-	if (not fs::exists(userDir))
-		fs::create_directories(userDir);
-
-	auto runID = UserService::instance().createRunID(user);
+	stop();
+}
 
-	Run run{ m_runsdir, runID, user, RunStatus::REGISTERED };
+void RunService::start()
+{
+	// Fill the registry before serving requests, the listings are read
+	// from it. When this fails the housekeeping thread tries again and
+	// the listings are read from disk in the meantime.
+	try
+	{
+		importRuns();
+		m_imported = true;
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << "Could not import the runs into the registry: " << ex.what() << std::endl;
+		prsm_db_connection::instance().reset();
+	}
 
-	std::ostringstream s;
-	s << std::setw(10) << std::setfill('0') << runID;
+	if (not m_housekeeping.joinable())
+		m_housekeeping = std::thread(std::bind(&RunService::runHousekeeping, this));
 
-	auto runDir = userDir / s.str();
+	if (not m_reaper.joinable())
+		m_reaper = std::thread(std::bind(&RunService::runReaper, this));
+}
 
-	if (fs::exists(runDir))
-		throw std::runtime_error("Internal error: run dir already exists");
+void RunService::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_cv_m);
+		m_done = true;
+		m_cv.notify_all();
+	}
 
-	fs::create_directory(runDir);
-	fs::create_directory(runDir / "output");
+	if (m_housekeeping.joinable())
+		m_housekeeping.join();
 
-	std::pair<const char *, const zh::file_param &> files[] = {
-		{ "PDB", pdb }, { "MTZ", mtz }, { "CIF", restraints }, { "SEQ", sequence }
-	};
+	if (m_reaper.joinable())
+		m_reaper.join();
+}
 
-	std::ofstream info(runDir / "info.txt");
+bool RunService::idle(std::chrono::milliseconds period)
+{
+	std::unique_lock<std::mutex> lock(m_cv_m);
+	return not m_cv.wait_for(lock, period, [this]
+		{ return m_done; });
+}
 
-	auto v_t = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-	std::ostringstream ss;
-	info << std::put_time(std::localtime(&v_t), "[%F]");
+void RunService::runHousekeeping()
+{
+	bool leader = false;
 
-	for (auto &&[type, file] : files)
+	while (idle(m_housekeepingInterval))
 	{
-		if (not file or file.length == 0)
-			continue;
-
-		zeep::char_streambuf sb(file.data, file.length);
-
-		gxrio::istream in(&sb);
+		try
+		{
+			if (not m_imported)
+			{
+				importRuns();
+				m_imported = true;
+			}
 
-		fs::path input = std::regex_match(file.filename, rx) ? file.filename : "input."s + type;
+			// Only one process, of all server instances sharing the database, does the housekeeping
+			if (not leader)
+				leader = prsm_db_connection::instance().try_advisory_lock(kHousekeepingLockKey);
 
-		if (input.extension() == ".gz")
-			input = input.stem();
+			if (not leader)
+				continue;
 
-		auto dir = runDir / "input" / type;
-		fs::create_directories(dir);
+			updateActiveRuns();
+			admitRuns();
 
-		std::ofstream out(dir / input, std::ios::binary);
+			UploadService::instance().expire();
 
-		out << in.rdbuf();
+			if (m_retention.enabled() and not m_retention.dryRun)
+				applyRetention();
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << ex.what() << std::endl;
 
-		info << ':' << type << '=' << input;
+			// the advisory lock is gone along with the connection
+			prsm_db_connection::instance().reset();
+			leader = false;
+		}
 	}
+}
 
-	// write parameters;
+void RunService::runReaper()
+{
+	bool leader = false;
 
-	if (not params.is_null())
+	while (idle(m_housekeepingInterval))
 	{
-		// backward compatible
-		info << ":PAIRED=" << (params["paired"] ? 1 : 0);
+		try
+		{
+			if (not leader)
+				leader = prsm_db_connection::instance().try_advisory_lock(kReaperLockKey);
 
-		std::ofstream paramsFile(runDir / "params.json");
-		paramsFile << params;
+			if (leader)
+				reapTrash();
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << ex.what() << std::endl;
+
+			prsm_db_connection::instance().reset();
+			leader = false;
+		}
 	}
+}
 
-	info << std::endl;
+// Remove the runs moved to the trash directory, limiting the amount
+// of data removed to m_reaperRate bytes per second. Whatever is left
+// over at shutdown is picked up again at the next start.
+void RunService::reapTrash()
+{
+	using namespace std::literals;
 
-	// create a flag to start processing
-	std::ofstream start(runDir / "startingProcess.txt");
+	const std::uintmax_t kMinimalFileCost = 4096;
+	const auto kSlice = 100ms;
+	const std::uintmax_t budget = std::max<std::uintmax_t>(m_reaperRate / 10, kMinimalFileCost);
 
-	run.status = RunStatus::STARTING;
+	std::error_code ec;
 
-	return run;
-}
+	auto trash = m_runsdir / kTrashDir;
+	if (not fs::is_directory(trash, ec))
+		return;
 
-std::vector<Run> RunService::getRunsForUser(const std::string &username)
-{
-	std::vector<Run> result;
+	std::vector<fs::path> deleted;
+	for (auto i = fs::directory_iterator(trash, ec); not ec and i != fs::directory_iterator(); i.increment(ec))
+		deleted.push_back(i->path());
 
-	auto dir = m_runsdir / username;
+	std::uintmax_t removed = 0;
 
-	if (fs::exists(dir))
+	for (auto &dir : deleted)
 	{
-		for (auto i = fs::directory_iterator(dir); i != fs::directory_iterator(); ++i)
+		std::vector<fs::path> files;
+		for (auto i = fs::recursive_directory_iterator(dir, ec); not ec and i != fs::recursive_directory_iterator(); i.increment(ec))
 		{
-			if (not i->is_directory())
-				continue;
+			if (not i->is_directory(ec))
+				files.push_back(i->path());
+		}
 
-			// auto name = i->path().filename().string();
-			if (not std::regex_match(i->path().filename().string(), kRunDirNameRx))
-				continue;
+		for (auto &file : files)
+		{
+			auto size = fs::file_size(file, ec);
+			if (ec)
+				size = 0;
 
-			if (not fs::is_directory(i->path() / "input"))
-				continue;
+			fs::remove(file, ec);
 
-			try
-			{
-				result.push_back(Run::create(i->path(), username));
-			}
-			catch (const std::exception &e)
+			removed += std::max(size, kMinimalFileCost);
+			if (removed >= budget)
 			{
-				std::cerr << e.what() << std::endl;
+				removed = 0;
+				if (not idle(kSlice))
+					return;
 			}
 		}
-	}
-
-	std::sort(result.begin(), result.end(), [](Run &a, Run &b)
-		{ return a.id < b.id; });
 
-	return result;
+		// only empty directories are left by now
+		fs::remove_all(dir, ec);
+		if (ec)
+			std::cerr << "Could not remove " << dir << ": " << ec.message() << std::endl;
+	}
 }
 
-Run RunService::getRun(const std::string &username, unsigned long runID)
+// Decompress an uploaded file into the staging directory, in a
+// subdirectory named key. Returns the path to the written file.
+static fs::path stageUpload(const fs::path &staging, const std::string &key, const std::string &type,
+	const std::string &filename, std::streambuf *sb)
 {
-	Run result;
+	using namespace std::literals;
 
-	auto dir = m_runsdir / username;
+	const std::regex rx("[-a-zA-Z0-9+_().]+");
 
-	if (fs::exists(dir))
-	{
-		std::ostringstream s;
-		s << std::setw(10) << std::setfill('0') << runID;
+	gxrio::istream in(sb);
 
-		if (fs::exists(dir / s.str()))
-			result = Run::create(dir / s.str(), username);
-	}
+	fs::path input = std::regex_match(filename, rx) ? filename : "input."s + type;
 
-	return result;
-}
+	if (input.extension() == ".gz")
+		input = input.stem();
 
-std::vector<Run> RunService::getAllRuns()
-{
-	std::vector<Run> result;
+	auto dir = staging / key;
+	fs::create_directories(dir);
 
-	for (auto userdir = fs::directory_iterator(m_runsdir); userdir != fs::directory_iterator(); ++userdir)
+	std::ofstream out(dir / input, std::ios::binary);
+
+	// Check the contents while writing, this way a bad file is rejected
+	// before the run is created.
+	std::unique_ptr<InputValidator> validator;
+	if (not mcfp::config::instance().has("no-preflight"))
+		validator = InputValidator::create(type, input);
+
+	std::vector<char> buffer(1024 * 1024);
+	for (;;)
 	{
-		if (not userdir->is_directory())
-			continue;
-		
-		for (auto i = fs::directory_iterator(*userdir); i != fs::directory_iterator(); ++i)
+		in.read(buffer.data(), buffer.size());
+
+		auto n = in.gcount();
+		if (n <= 0)
+			break;
+
+		out.write(buffer.data(), n);
+
+		if (validator)
+			validator->feed(buffer.data(), n);
+	}
+
+	if (in.bad())
+		throw std::runtime_error("Could not read uploaded file " + input.string() + ", is it compressed correctly?");
+
+	if (not out)
+		throw std::runtime_error("Could not store uploaded file " + input.string());
+
+	if (validator)
+		validator->finish();
+
+	return dir / input;
+}
+
+static fs::path stageUpload(const fs::path &staging, const std::string &key, const std::string &type, const zh::file_param &file)
+{
+	zeep::char_streambuf sb(file.data, file.length);
+	return stageUpload(staging, key, type, file.filename, &sb);
+}
+
+static fs::path stageUpload(const fs::path &staging, const std::string &key, const std::string &type, const fs::path &file)
+{
+	std::filebuf sb;
+	if (sb.open(file, std::ios::in | std::ios::binary) == nullptr)
+		throw std::runtime_error("Could not open uploaded file " + file.filename().string());
+	return stageUpload(staging, key, type, file.filename().string(), &sb);
+}
+
+// Put a staged file into a run. The last run using it gets the file
+// itself, others a hard link. Copy only when that fails, e.g. when the
+// staging directory is on another device.
+static void placeInput(const fs::path &from, const fs::path &to, bool last)
+{
+	std::error_code ec;
+	if (last)
+		fs::rename(from, to, ec);
+	else
+		fs::create_hard_link(from, to, ec);
+
+	if (ec)
+		fs::copy_file(from, to);
+}
+
+// The number of runs using each staged file
+static std::map<fs::path, std::size_t> countUses(const std::vector<std::vector<std::tuple<std::string, fs::path>>> &inputs)
+{
+	std::map<fs::path, std::size_t> result;
+	for (auto &input : inputs)
+	{
+		for (auto &&[type, file] : input)
+			++result[file];
+	}
+	return result;
+}
+
+fs::path RunService::createStagingDir(const std::string &user)
+{
+	std::random_device rng;
+
+	auto now = std::chrono::system_clock::now().time_since_epoch();
+	auto dir = m_runsdir / kUploadDir / (user + '-' + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(now).count()) + '-' + std::to_string(rng()));
+
+	fs::create_directories(dir);
+
+	return dir;
+}
+
+// Check the quota, taking into account the size of the runs about to be created
+void RunService::checkQuota(const std::string &user, std::uintmax_t additional)
+{
+	if (m_userQuota > 0 and getDiskUsage(user).size + additional > m_userQuota)
+		throw std::runtime_error("Disk quota exceeded, please delete some of your old jobs first");
+}
+
+Run RunService::submit(const std::string &user, const zh::file_param &pdb, const zh::file_param &mtz,
+	const zh::file_param &restraints, const zh::file_param &sequence, const zeep::json::element &params,
+	const std::map<std::string, fs::path> &uploads)
+{
+	checkQuota(user);
+
+	auto staging = createStagingDir(user);
+
+	try
+	{
+		std::pair<const char *, const zh::file_param &> files[] = {
+			{ "PDB", pdb }, { "MTZ", mtz }, { "CIF", restraints }, { "SEQ", sequence }
+		};
+
+		std::vector<std::tuple<std::string, fs::path>> input;
+
+		for (auto &&[type, file] : files)
 		{
-			if (not i->is_directory())
-				continue;
+			if (file and file.length > 0)
+				input.emplace_back(type, stageUpload(staging, type, type, file));
+			else if (auto u = uploads.find(type); u != uploads.end())
+				input.emplace_back(type, stageUpload(staging, type, type, u->second));
+		}
 
-			// auto name = i->path().filename().string();
-			if (not std::regex_match(i->path().filename().string(), kRunDirNameRx))
-				continue;
+		std::uintmax_t size = 0;
+		for (auto &&[type, file] : input)
+			size += fs::file_size(file);
 
-			if (not fs::is_directory(i->path() / "input"))
-				continue;
+		checkQuota(user, size);
+
+		auto uses = countUses({ input });
+		auto run = createRun(user, input, params, uses);
+
+		fs::remove_all(staging);
+
+		return run;
+	}
+	catch (...)
+	{
+		std::error_code ec;
+		fs::remove_all(staging, ec);
+		throw;
+	}
+}
+
+// Submit a series of runs sharing the same coordinates and data. Each
+// entry in runs may contain parameters and the index of the restraints
+// and sequence file to use. Uploaded files are decompressed only once,
+// the runs share them through hard links.
+std::vector<Run> RunService::submitBatch(const std::string &user, const zh::file_param &pdb, const zh::file_param &mtz,
+	const std::vector<zh::file_param> &restraints, const std::vector<zh::file_param> &sequences, const zeep::json::element &runs)
+{
+	if (not runs.is_array() or runs.empty())
+		throw std::runtime_error("No runs specified");
+
+	if (m_maxBatchSize > 0 and runs.size() > static_cast<std::size_t>(m_maxBatchSize))
+		throw std::runtime_error("Too many runs in batch, the maximum is " + std::to_string(m_maxBatchSize));
+
+	// Check the variant indices first, before anything is created
+	auto variant = [](const zeep::json::element &r, const char *name, std::size_t count) -> std::optional<std::size_t>
+	{
+		if (r.contains(name))
+		{
+			auto ix = r[name].as<int>();
+			if (ix < 0 or static_cast<std::size_t>(ix) >= count)
+				throw std::runtime_error(std::string("Invalid ") + name + " index " + std::to_string(ix));
+			return ix;
+		}
+
+		// a single variant is shared by all runs
+		if (count == 1)
+			return 0;
+
+		return {};
+	};
+
+	for (auto &r : runs)
+	{
+		variant(r, "restraints", restraints.size());
+		variant(r, "sequence", sequences.size());
+	}
+
+	checkQuota(user);
+
+	auto staging = createStagingDir(user);
+
+	try
+	{
+		std::vector<std::tuple<std::string, fs::path>> shared;
+
+		if (pdb and pdb.length > 0)
+			shared.emplace_back("PDB", stageUpload(staging, "PDB", "PDB", pdb));
+		if (mtz and mtz.length > 0)
+			shared.emplace_back("MTZ", stageUpload(staging, "MTZ", "MTZ", mtz));
+
+		std::vector<fs::path> stagedRestraints, stagedSequences;
+
+		for (std::size_t i = 0; i < restraints.size(); ++i)
+			stagedRestraints.push_back(stageUpload(staging, "CIF-" + std::to_string(i), "CIF", restraints[i]));
+
+		for (std::size_t i = 0; i < sequences.size(); ++i)
+			stagedSequences.push_back(stageUpload(staging, "SEQ-" + std::to_string(i), "SEQ", sequences[i]));
+
+		std::vector<std::vector<std::tuple<std::string, fs::path>>> inputs;
+
+		for (auto &r : runs)
+		{
+			auto input = shared;
+
+			if (auto ix = variant(r, "restraints", restraints.size()); ix.has_value())
+				input.emplace_back("CIF", stagedRestraints[*ix]);
 
+			if (auto ix = variant(r, "sequence", sequences.size()); ix.has_value())
+				input.emplace_back("SEQ", stagedSequences[*ix]);
+
+			inputs.push_back(std::move(input));
+		}
+
+		// The size of the whole batch. The runs share their input, but the
+		// usage of each run includes it, so it is counted for each of them.
+		std::uintmax_t size = 0;
+		for (auto &input : inputs)
+		{
+			for (auto &&[type, file] : input)
+				size += fs::file_size(file);
+		}
+
+		checkQuota(user, size);
+
+		std::vector<Run> result;
+
+		auto uses = countUses(inputs);
+
+		auto input = inputs.begin();
+		for (auto &r : runs)
+			result.push_back(createRun(user, *input++, r.contains("parameters") ? r["parameters"] : zeep::json::element(), uses));
+
+		fs::remove_all(staging);
+
+		return result;
+	}
+	catch (...)
+	{
+		std::error_code ec;
+		fs::remove_all(staging, ec);
+		throw;
+	}
+}
+
+// Create the run directory for a run with the staged input files
+Run RunService::createRun(const std::string &user, const std::vector<std::tuple<std::string, fs::path>> &input, const zeep::json::element &params,
+	std::map<fs::path, std::size_t> &uses)
+{
+	// create user directory first, if needed
+	auto userDir = m_runsdir / user;
+	if (not fs::exists(userDir))
+		fs::create_directories(userDir);
+
+	auto runID = UserService::instance().createRunID(user);
+
+	auto runDir = userDir / runDirName(runID);
+
+	if (fs::exists(runDir))
+		throw std::runtime_error("Internal error: run dir already exists");
+
+	fs::create_directory(runDir);
+	fs::create_directory(runDir / "output");
+
+	std::ofstream info(runDir / "info.txt");
+
+	auto v_t = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+	info << std::put_time(std::localtime(&v_t), "[%F]");
+
+	for (auto &[type, file] : input)
+	{
+		auto dir = runDir / "input" / type;
+		fs::create_directories(dir);
+
+		placeInput(file, dir / file.filename(), --uses[file] == 0);
+
+		info << ':' << type << '=' << file.filename();
+	}
+
+	// write parameters;
+
+	if (not params.is_null())
+	{
+		// backward compatible
+		info << ":PAIRED=" << (params["paired"] ? 1 : 0);
+
+		std::ofstream paramsFile(runDir / "params.json");
+		paramsFile << params;
+	}
+
+	info << std::endl;
+	info.close();
+
+	// create a flag to start processing, unless the admission
+	// scheduler decides when to start
+	if (not hasAdmissionLimits())
+		std::ofstream start(runDir / "startingProcess.txt");
+
+	auto run = Run::create(runDir, user);
+	run.size = directorySize(runDir);
+
+	pqxx::transaction tx(prsm_db_connection::instance());
+	storeRun(tx, run);
+	tx.commit();
+
+	return run;
+}
+
+std::vector<Run> RunService::getRunsForUser(const std::string &username)
+{
+	std::vector<Run> result;
+
+	// The registry is not filled yet, read the runs from disk
+	if (not m_imported)
+	{
+		if (fs::is_directory(m_runsdir / username))
+			result = collectRuns(m_runsdir / username, username);
+
+		std::sort(result.begin(), result.end(), [](Run &a, Run &b)
+			{ return a.id < b.id; });
+
+		for (auto &run : result)
+			estimate(run);
+
+		return result;
+	}
+
+	pqxx::transaction tx(prsm_db_connection::instance());
+	auto rows = tx.exec(std::string(kSelectRuns) + " WHERE u.name = " + tx.quote(username) + " ORDER BY r.id");
+
+	for (auto row : rows)
+		result.push_back(Run::create(row, m_runsdir));
+
+	tx.commit();
+
+	for (auto &run : result)
+		estimate(run);
+
+	return result;
+}
+
+Run RunService::getRun(const std::string &username, unsigned long runID)
+{
+	Run result;
+
+	pqxx::transaction tx(prsm_db_connection::instance());
+	auto rows = tx.exec(std::string(kSelectRuns) + " WHERE u.name = " + tx.quote(username) + " AND r.id = " + tx.quote(runID));
+
+	if (rows.size() == 1)
+		result = Run::create(rows[0], m_runsdir);
+	else
+	{
+		// Not in the registry (yet), try the file system
+		auto dir = m_runsdir / username / runDirName(runID);
+
+		if (fs::exists(dir))
+		{
+			result = Run::create(dir, username);
+			result.size = directorySize(dir);
+			storeRun(tx, result);
+		}
+	}
+
+	tx.commit();
+
+	if (not result.user.empty())
+		estimate(result);
+
+	return result;
+}
+
+// One archive containing the results of several runs, each in its own directory
+std::tuple<std::istream *, std::string> RunService::getZippedRuns(const std::string &username, const std::vector<unsigned long> &runIDs,
+	const FileSelection &selection, ArchiveFormat format)
+{
+	if (runIDs.empty())
+		throw std::runtime_error("No runs specified");
+
+	std::unique_ptr<ArchiveStream> zs(new ArchiveStream(format));
+
+	for (auto runID : runIDs)
+	{
+		auto run = getRun(username, runID);
+		if (run.user.empty())
+			throw std::runtime_error("Run " + std::to_string(runID) + " does not exist");
+
+		run.addResultFiles(*zs, runDirName(runID), selection);
+	}
+
+	if (zs->empty())
+		throw std::runtime_error("No result files match the selection");
+
+	return { zs.release(), username + "-runs" + archiveExtension(format) };
+}
+
+std::vector<Run> RunService::getAllRuns(std::size_t maxCount)
+{
+	if (not m_imported)
+		return scanAllRuns(maxCount);
+
+	std::vector<Run> result;
+
+	std::string query = std::string(kSelectRuns) + " ORDER BY r.created DESC";
+	if (maxCount > 0)
+		query += " LIMIT " + std::to_string(maxCount);
+
+	pqxx::transaction tx(prsm_db_connection::instance());
+	auto rows = tx.exec(query);
+
+	result.reserve(rows.size());
+	for (auto row : rows)
+		result.push_back(Run::create(row, m_runsdir));
+
+	tx.commit();
+
+	return result;
+}
+
+std::vector<Run> RunService::scanAllRuns(std::size_t maxCount)
+{
+	std::vector<fs::path> userDirs;
+
+	for (auto userdir = fs::directory_iterator(m_runsdir); userdir != fs::directory_iterator(); ++userdir)
+	{
+		// skip our own administration, like the trash directory
+		if (userdir->is_directory() and userdir->path().filename().string().front() != '.')
+			userDirs.push_back(userdir->path());
+	}
+
+	// Scan the user directories in parallel. Each worker claims the next
+	// unclaimed directory, that way a few users with lots of runs do not
+	// hold up the rest. The runs per user are sorted newest first.
+
+	std::vector<std::vector<Run>> runsPerUser(userDirs.size());
+	std::atomic<std::size_t> next{ 0 };
+
+	auto worker = [&]()
+	{
+		for (auto ix = next++; ix < userDirs.size(); ix = next++)
+		{
 			try
 			{
-				result.push_back(Run::create(i->path(), userdir->path().filename().string()));
+				auto runs = collectRuns(userDirs[ix], userDirs[ix].filename().string());
+
+				std::sort(runs.begin(), runs.end(), [](Run &a, Run &b)
+					{ return a.date > b.date; });
+
+				runsPerUser[ix] = std::move(runs);
 			}
 			catch (const std::exception &e)
 			{
 				std::cerr << e.what() << std::endl;
 			}
 		}
+	};
+
+	std::size_t nrOfThreads = std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1U), userDirs.size());
+
+	std::vector<std::thread> threads;
+	for (std::size_t i = 1; i < nrOfThreads; ++i)
+		threads.emplace_back(worker);
+
+	worker();
+
+	for (auto &t : threads)
+		t.join();
+
+	// Now merge the sorted lists, stopping as soon as we have enough
+
+	std::size_t total = 0;
+	for (auto &runs : runsPerUser)
+		total += runs.size();
+
+	if (maxCount == 0 or maxCount > total)
+		maxCount = total;
+
+	std::vector<Run> result;
+	result.reserve(maxCount);
+
+	using head_type = std::tuple<std::size_t, std::size_t>; // index in runsPerUser, index in that list
+
+	auto cmp = [&runsPerUser](const head_type &a, const head_type &b)
+	{
+		const auto &[ua, ra] = a;
+		const auto &[ub, rb] = b;
+		return runsPerUser[ua][ra].date < runsPerUser[ub][rb].date;
+	};
+
+	std::priority_queue<head_type, std::vector<head_type>, decltype(cmp)> heads(cmp);
+
+	for (std::size_t ix = 0; ix < runsPerUser.size(); ++ix)
+	{
+		if (not runsPerUser[ix].empty())
+			heads.emplace(ix, 0);
 	}
 
-	std::sort(result.begin(), result.end(), [](Run &a, Run &b)
-		{ return a.date > b.date; });
+	while (result.size() < maxCount and not heads.empty())
+	{
+		auto [u, r] = heads.top();
+		heads.pop();
+
+		result.emplace_back(std::move(runsPerUser[u][r]));
+
+		if (r + 1 < runsPerUser[u].size())
+			heads.emplace(u, r + 1);
+	}
 
 	return result;
 }
@@ -472,10 +1315,483 @@ void RunService::deleteRun(const std::string &username, unsigned long runID)
 	if (not fs::exists(dir))
 		throw std::runtime_error("Run does not exist");
 
-	std::ostringstream s;
-	s << std::setw(10) << std::setfill('0') << runID;
+	fs::path rundir = dir / runDirName(runID);
+
+	// Move the run directory out of the way, this is atomic and fast.
+	// The reaper thread will remove the files in the background.
+	if (fs::exists(rundir))
+	{
+		auto trash = m_runsdir / kTrashDir;
+		fs::create_directories(trash);
+
+		auto now = std::chrono::system_clock::now().time_since_epoch();
+		auto name = username + '-' + runDirName(runID) + '-' + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+
+		fs::rename(rundir, trash / name);
+	}
+
+	RamaAnglesService::instance().remove(RamaAnglesService::runKey(username, runID));
+
+	pqxx::transaction tx(prsm_db_connection::instance());
+	removeRun(tx, username, runID);
+	tx.commit();
+}
+
+// --------------------------------------------------------------------
+// The run registry
+
+// The size is stored as found in run, it is up to the caller to measure
+// it. That happens when a run is submitted, when it is first registered
+// and when it has finished. Otherwise the size in the registry is kept.
+void RunService::storeRun(pqxx::transaction_base &tx, const Run &run)
+{
+	auto r = tx.exec0(
+		R"(INSERT INTO redo.run (id, user_id, status, has_image, created, started, running, ended, input, score, size, rank)
+		   SELECT )" + tx.quote(run.id) + R"(, id, )"
+					 + tx.quote(zeep::value_serializer<RunStatus>::to_string(run.status)) + ", "
+					 + (run.has_image ? "true" : "false") + ", "
+					 + sqlTimestamp(run.date) + ", "
+					 + sqlTimestamp(run.started) + ", "
+					 + sqlTimestamp(run.running) + ", "
+					 + sqlTimestamp(run.ended) + ", "
+					 + sqlJSON(tx, run.input) + ", "
+					 + (run.score ? sqlJSON(tx, *run.score) : "NULL") + ", "
+					 + tx.quote(run.size) + ", "
+					 + (run.rank ? tx.quote(*run.rank) : "NULL") + R"(
+			 FROM redo.user
+			WHERE name = )" + tx.quote(run.user) + R"(
+		   ON CONFLICT (user_id, id) DO UPDATE
+			  SET status = EXCLUDED.status,
+				  has_image = EXCLUDED.has_image,
+				  started = EXCLUDED.started,
+				  running = EXCLUDED.running,
+				  ended = EXCLUDED.ended,
+				  input = EXCLUDED.input,
+				  score = EXCLUDED.score,
+				  size = EXCLUDED.size,
+				  rank = EXCLUDED.rank,
+				  modified = CURRENT_TIMESTAMP)");
+
+	// The insert selects from redo.user, nothing is stored for an unknown user
+	if (r.affected_rows() == 0)
+		throw std::runtime_error("Could not store run " + std::to_string(run.id) + ", user " + run.user + " is not known");
+}
+
+void RunService::removeRun(pqxx::transaction_base &tx, const std::string &username, unsigned long runID)
+{
+	tx.exec0(
+		R"(DELETE FROM redo.run
+			WHERE id = )" + tx.quote(runID) + R"(
+			  AND user_id = (SELECT id FROM redo.user WHERE name = )" + tx.quote(username) + "))");
+}
+
+// Synchronise the registry with what is found on disk
+void RunService::importRuns()
+{
+	auto runs = scanAllRuns();
+
+	pqxx::transaction tx(prsm_db_connection::instance());
+
+	auto rows = tx.exec(R"(SELECT u.name, r.id, r.status, r.size FROM redo.run r JOIN redo.user u ON r.user_id = u.id)");
+
+	std::map<std::tuple<std::string, unsigned long>, std::tuple<RunStatus, std::uintmax_t>> registered;
+	for (auto row : rows)
+	{
+		registered.emplace(std::make_tuple(row[0].as<std::string>(), row[1].as<unsigned long>()),
+			std::make_tuple(zeep::value_serializer<RunStatus>::from_string(row[2].as<std::string>()), row[3].as<std::uintmax_t>()));
+	}
+
+	auto finished = [](RunStatus status)
+	{
+		return status == RunStatus::ENDED or status == RunStatus::STOPPED;
+	};
+
+	for (auto &run : runs)
+	{
+		// Measure new runs and runs that finished since they were stored
+		auto r = registered.find({ run.user, run.id });
+		if (r != registered.end() and (finished(std::get<0>(r->second)) or not finished(run.status)))
+			run.size = std::get<1>(r->second);
+		else
+			run.size = directorySize(run.m_dir);
+
+		try
+		{
+			storeRun(tx, run);
+		}
+		catch (const pqxx::failure &)
+		{
+			// the transaction is aborted
+			throw;
+		}
+		catch (const std::runtime_error &ex)
+		{
+			// a run of an unknown user, skip it
+			std::cerr << ex.what() << std::endl;
+		}
+	}
+
+	for (auto row : rows)
+	{
+		auto username = row[0].as<std::string>();
+		auto runID = row[1].as<unsigned long>();
+
+		if (not fs::exists(m_runsdir / username / runDirName(runID)))
+			removeRun(tx, username, runID);
+	}
+
+	tx.commit();
+}
+
+// Check the flag files of the runs that have not finished yet
+void RunService::updateActiveRuns()
+{
+	pqxx::transaction tx(prsm_db_connection::instance());
+
+	auto rows = tx.exec(std::string(kSelectRuns) + R"( WHERE r.status NOT IN ('ended', 'stopped'))");
+
+	for (auto row : rows)
+	{
+		auto registered = Run::create(row, m_runsdir);
+
+		if (not fs::exists(registered.m_dir))
+		{
+			removeRun(tx, registered.user, registered.id);
+			continue;
+		}
+
+		// Only read the run completely when something changed. The rank in
+		// the queue is the contents of a file, it is read each time.
+		auto status = Run::getStatus(registered.m_dir);
+		if (status == registered.status and status != RunStatus::QUEUED and
+			fs::exists(registered.m_dir / "pdbin.png") == registered.has_image)
+			continue;
+
+		auto run = Run::create(registered.m_dir, registered.user);
+
+		// Only runs that have not finished are selected, measure them once they do
+		if (run.status == RunStatus::ENDED or run.status == RunStatus::STOPPED)
+			run.size = directorySize(run.m_dir);
+		else
+			run.size = registered.size;
+
+		if (run.status != registered.status or
+			run.has_image != registered.has_image or
+			run.rank != registered.rank or
+			run.score.has_value() != registered.score.has_value())
+		{
+			storeRun(tx, run);
+		}
+	}
+
+	tx.commit();
+}
+
+// --------------------------------------------------------------------
+// Admission
+
+// Hand over waiting runs to the pipeline. Each waiting run gets a slot
+// number for its user: the number of active runs of that user plus its
+// position in that user's queue. Taking the runs in slot order gives
+// every user a fair share of the free capacity, regardless of how many
+// runs someone submitted. Without limits all waiting runs are admitted,
+// these are left when the limits were removed while runs were waiting.
+void RunService::admitRuns()
+{
+	pqxx::transaction tx(prsm_db_connection::instance());
+
+	std::string limit;
+	if (m_maxActive > 0)
+	{
+		auto active = tx.exec1(std::string("SELECT count(*) FROM redo.run WHERE status IN ") + kActiveStates)[0].as<long>();
+		if (active >= m_maxActive)
+			return;
+
+		limit = " LIMIT " + std::to_string(m_maxActive - active);
+	}
+
+	auto rows = tx.exec(
+		R"(WITH active AS (
+			SELECT user_id, count(*) AS n FROM redo.run WHERE status IN )" + std::string(kActiveStates) + R"( GROUP BY user_id
+		), waiting AS (
+			SELECT r.user_id, r.id, r.created, r.size,
+				   coalesce(a.n, 0) + row_number() OVER (PARTITION BY r.user_id ORDER BY r.created, r.id) AS slot
+			  FROM redo.run r LEFT JOIN active a ON a.user_id = r.user_id
+			 WHERE r.status = 'registered'
+		)
+		SELECT u.name, w.id, w.size
+		  FROM waiting w JOIN redo.user u ON u.id = w.user_id)"
+		+ (m_maxActivePerUser > 0 ? " WHERE w.slot <= " + std::to_string(m_maxActivePerUser) : "")
+		+ " ORDER BY w.slot, w.created, w.id" + limit);
+
+	for (auto row : rows)
+	{
+		auto username = row[0].as<std::string>();
+		auto runID = row[1].as<unsigned long>();
 
-	fs::path rundir = dir / s.str();
+		auto dir = m_runsdir / username / runDirName(runID);
+		if (not fs::exists(dir))
+		{
+			removeRun(tx, username, runID);
+			continue;
+		}
+
+		std::ofstream start(dir / "startingProcess.txt");
+		start.close();
 
-	fs::remove_all(rundir);
-}
\ No newline at end of file
+		auto run = Run::create(dir, username);
+		run.size = row[2].as<std::uintmax_t>();
+		storeRun(tx, run);
+	}
+
+	tx.commit();
+}
+
+QueueState RunService::getQueueState()
+{
+	QueueState result{ m_maxActive, m_maxActivePerUser };
+
+	pqxx::transaction tx(prsm_db_connection::instance());
+
+	auto rows = tx.exec(
+		R"(SELECT u.name,
+				  count(*) FILTER (WHERE r.status IN )" + std::string(kActiveStates) + R"(),
+				  count(*) FILTER (WHERE r.status = 'registered')
+			 FROM redo.run r JOIN redo.user u ON r.user_id = u.id
+			WHERE r.status = 'registered' OR r.status IN )" + kActiveStates + R"(
+			GROUP BY u.name
+			ORDER BY u.name)");
+
+	for (auto row : rows)
+	{
+		QueuedUser qu{ row[0].as<std::string>(), row[1].as<std::size_t>(), row[2].as<std::size_t>() };
+
+		result.active += qu.active;
+		result.waiting += qu.waiting;
+		result.users.push_back(std::move(qu));
+	}
+
+	tx.commit();
+
+	return result;
+}
+
+// --------------------------------------------------------------------
+// Estimates
+
+const std::size_t kTimingWindow = 100;
+
+// Rebuild the rolling window from the last runs that ended. The window is
+// read again completely, runs can be registered as ended later than their
+// ended time suggests, e.g. by an import, and are picked up this way.
+// Each process keeps its own window, refreshed at most once per
+// housekeeping interval.
+void RunService::refreshTimings()
+{
+	using namespace std::chrono;
+
+	auto now = system_clock::now();
+	if (now - m_timingsRefreshed < m_housekeepingInterval)
+		return;
+
+	m_timingsRefreshed = now;
+
+	pqxx::transaction tx(prsm_db_connection::instance());
+
+	m_runningCount = tx.exec1("SELECT count(*) FROM redo.run WHERE status = 'running'")[0].as<std::size_t>();
+
+	auto rows = tx.exec(
+		R"(SELECT started, running, ended FROM redo.run
+			WHERE status = 'ended'
+			  AND started IS NOT NULL AND running IS NOT NULL AND ended IS NOT NULL
+			ORDER BY ended DESC
+			LIMIT )" + std::to_string(kTimingWindow));
+
+	tx.commit();
+
+	m_timings.clear();
+	m_waitSum = m_runSum = {};
+
+	for (auto row : rows)
+	{
+		auto started = parse_timestamp(row.at(0).as<std::string>());
+		auto running = parse_timestamp(row.at(1).as<std::string>());
+		auto ended = parse_timestamp(row.at(2).as<std::string>());
+
+		auto wait = duration_cast<seconds>(running - started);
+		auto run = duration_cast<seconds>(ended - running);
+
+		if (wait.count() < 0 or run.count() < 0)
+			continue;
+
+		m_timings.emplace_back(wait, run);
+		m_waitSum += wait;
+		m_runSum += run;
+	}
+}
+
+void RunService::estimate(Run &run)
+{
+	using namespace std::chrono;
+
+	if (run.status != RunStatus::REGISTERED and run.status != RunStatus::STARTING and
+		run.status != RunStatus::QUEUED and run.status != RunStatus::RUNNING)
+		return;
+
+	std::unique_lock lock(m_timings_m);
+
+	try
+	{
+		refreshTimings();
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << ex.what() << std::endl;
+	}
+
+	if (m_timings.empty())
+		return;
+
+	auto n = static_cast<long>(m_timings.size());
+	auto meanWait = m_waitSum / n;
+	auto meanRun = m_runSum / n;
+
+	// the pipeline runs this many jobs side by side
+	auto slots = std::max<long>(static_cast<long>(m_runningCount), 1);
+
+	lock.unlock();
+
+	auto now = system_clock::now();
+	time_point<system_clock> start;
+
+	switch (run.status)
+	{
+		case RunStatus::REGISTERED:
+			start = now + meanWait;
+			break;
+
+		case RunStatus::STARTING:
+			start = std::max(now, run.started.value_or(now) + meanWait);
+			break;
+
+		case RunStatus::QUEUED:
+			start = now + meanRun * static_cast<long>(run.rank.value_or(1)) / slots;
+			break;
+
+		default:
+			start = run.running.value_or(now);
+			break;
+	}
+
+	run.estimatedStart = start;
+	run.estimatedEnd = std::max(now, start + meanRun);
+}
+
+// --------------------------------------------------------------------
+// Disk usage, the sum of the sizes recorded in the registry
+
+std::vector<DiskUsage> RunService::getDiskUsage()
+{
+	std::vector<DiskUsage> result;
+
+	pqxx::transaction tx(prsm_db_connection::instance());
+
+	auto rows = tx.exec(
+		R"(SELECT u.name, count(*), sum(r.size)
+			 FROM redo.run r JOIN redo.user u ON r.user_id = u.id
+			GROUP BY u.name
+			ORDER BY sum(r.size) DESC)");
+
+	for (auto row : rows)
+		result.push_back({ row[0].as<std::string>(), row[1].as<std::size_t>(), row[2].as<std::uintmax_t>() });
+
+	tx.commit();
+
+	return result;
+}
+
+DiskUsage RunService::getDiskUsage(const std::string &username)
+{
+	pqxx::transaction tx(prsm_db_connection::instance());
+
+	auto row = tx.exec1(
+		R"(SELECT count(r.id), coalesce(sum(r.size), 0)
+			 FROM redo.user u LEFT JOIN redo.run r ON r.user_id = u.id
+			WHERE u.name = )" + tx.quote(username));
+
+	tx.commit();
+
+	return { username, row[0].as<std::size_t>(), row[1].as<std::uintmax_t>() };
+}
+
+// --------------------------------------------------------------------
+// Retention
+
+std::vector<RetentionCandidate> RunService::getRetentionCandidates(std::size_t maxCount)
+{
+	std::vector<RetentionCandidate> result;
+
+	auto query = m_retention.query();
+	if (query.empty())
+		return result;
+
+	query += " ORDER BY c.created";
+	if (maxCount > 0)
+		query += " LIMIT " + std::to_string(maxCount);
+
+	pqxx::transaction tx(prsm_db_connection::instance());
+
+	for (auto row : tx.exec(query))
+	{
+		result.push_back({
+			row.at("user").as<std::string>(),
+			row.at("id").as<uint32_t>(),
+			zeep::value_serializer<RunStatus>::from_string(row.at("status").as<std::string>()),
+			parse_timestamp(row.at("created").as<std::string>()),
+			row.at("reason").as<std::string>() });
+	}
+
+	tx.commit();
+
+	return result;
+}
+
+RetentionStats RunService::getRetentionStats()
+{
+	RetentionStats result{ m_retention };
+
+	pqxx::transaction tx(prsm_db_connection::instance());
+
+	auto r = tx.exec1(R"(SELECT count(*), count(*) FILTER (WHERE status NOT IN ('ended', 'stopped')), min(created) FROM redo.run)");
+
+	result.runs = r[0].as<std::size_t>();
+	result.activeRuns = r[1].as<std::size_t>();
+	if (not r[2].is_null())
+		result.oldest = parse_timestamp(r[2].as<std::string>());
+
+	auto query = m_retention.query();
+	if (not query.empty())
+		result.candidates = tx.exec1("SELECT count(*) FROM (" + query + ") q")[0].as<std::size_t>();
+
+	tx.commit();
+
+	return result;
+}
+
+// Remove at most a batch of runs per tick, the files themselves are
+// removed by the reaper at its own pace.
+void RunService::applyRetention()
+{
+	for (auto &c : getRetentionCandidates(m_retention.batchSize))
+	{
+		try
+		{
+			deleteRun(c.user, c.id);
+			std::cerr << "Retention (" << c.reason << "): removed run " << c.id << " of user " << c.user << std::endl;
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Retention: could not remove run " << c.id << " of user " << c.user << ": " << ex.what() << std::endl;
+		}
+	}
+}
@@ -26,13 +26,25 @@
 
 #pragma once
 
-#include <string>
-#include <memory>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 
 #include <zeep/json/element.hpp>
 #include <zeep/http/request.hpp>
 
+#include <pqxx/pqxx>
+
+#include "entry-classes.hpp"
+#include "stats-service.hpp"
+#include "zip-support.hpp"
+
 enum class RunStatus
 {
 	UNDEFINED,
@@ -103,12 +115,36 @@ struct Score
 	std::optional<ProteinGeometry> proteinGeometry;
 	std::optional<NucleicAcidGeometry> nucleicAcidGeometry;
 
+	// Calculated once when the run has ended and stored with the score
+	std::optional<StatsPercentiles> percentiles;
+	std::optional<EntryClasses> classes;
+
 	template<typename Archive>
 	void serialize(Archive& ar, unsigned long version)
 	{
 		ar & zeep::make_nvp("ddatafit", ddatafit)
 		   & zeep::make_nvp("geometry", proteinGeometry)
-		   & zeep::make_nvp("basePairs", nucleicAcidGeometry);
+		   & zeep::make_nvp("basePairs", nucleicAcidGeometry)
+		   & zeep::make_nvp("percentiles", percentiles)
+		   & zeep::make_nvp("classes", classes);
+	}
+};
+
+// A part of the process.log of a run
+struct LogChunk
+{
+	std::uintmax_t offset = 0;	// where to continue reading
+	std::string text;
+	RunStatus status;
+	bool finished = false;		// the run has ended and all of the log was read
+
+	template<typename Archive>
+	void serialize(Archive& ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("offset", offset)
+		   & zeep::make_nvp("text", text)
+		   & zeep::make_nvp("status", status)
+		   & zeep::make_nvp("finished", finished);
 	}
 };
 
@@ -124,13 +160,35 @@ struct Run
 	std::optional<std::chrono::time_point<std::chrono::system_clock>> started;
 	std::optional<Score> score;
 	std::vector<std::string> input;
+	std::optional<std::chrono::time_point<std::chrono::system_clock>> running;
+	std::optional<std::chrono::time_point<std::chrono::system_clock>> ended;
+	std::uintmax_t size = 0;
+
+	// The position in the pipeline queue, as found in rank.txt
+	std::optional<int> rank;
+
+	// Estimates, only filled in for runs that have not finished yet
+	std::optional<std::chrono::time_point<std::chrono::system_clock>> estimatedStart;
+	std::optional<std::chrono::time_point<std::chrono::system_clock>> estimatedEnd;
 
 	static Run create(const std::filesystem::path& dir, const std::string& username);
+	static Run create(const pqxx::row &row, const std::filesystem::path& runsDir);
+
+	// The status from the flag files only, much cheaper than create
+	static RunStatus getStatus(const std::filesystem::path& dir);
 
 	std::vector<std::string> getResultFileList();
 	std::filesystem::path getResultFile(const std::string& file);
 	std::filesystem::path getImageFile();
-	std::tuple<std::istream *, std::string> getZippedResultFile();
+
+	// Read the log starting at offset. When there is nothing new, wait at
+	// most wait, capped at two seconds, for the log to change.
+	LogChunk getLog(std::uintmax_t offset, std::chrono::seconds wait = {});
+	std::tuple<std::istream *, std::string> getZippedResultFile(const FileSelection &selection = {},
+		ArchiveFormat format = ArchiveFormat::ZIP);
+
+	// Add the selected result files to an archive, in directory dir
+	void addResultFiles(ArchiveStream &zs, const std::filesystem::path &dir, const FileSelection &selection = {});
 
 	template<typename Archive>
 	void serialize(Archive& ar, unsigned long version)
@@ -142,7 +200,157 @@ struct Run
 		   & zeep::make_nvp("date", date)
 		   & zeep::make_nvp("started-date", started)
 		   & zeep::make_nvp("score", score)
-		   & zeep::make_nvp("input", input);
+		   & zeep::make_nvp("input", input)
+		   & zeep::make_nvp("running-date", running)
+		   & zeep::make_nvp("ended-date", ended)
+		   & zeep::make_nvp("size", size)
+		   & zeep::make_nvp("rank", rank)
+		   & zeep::make_nvp("estimated-start", estimatedStart)
+		   & zeep::make_nvp("estimated-end", estimatedEnd);
+	}
+};
+
+struct DiskUsage
+{
+	std::string user;
+	std::size_t runs = 0;
+	std::uintmax_t size = 0;
+
+	template<typename Archive>
+	void serialize(Archive& ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("user", user)
+		   & zeep::make_nvp("runs", runs)
+		   & zeep::make_nvp("size", size);
+	}
+};
+
+// --------------------------------------------------------------------
+// Admission, new runs wait in the registered state until the scheduler
+// hands them over to the pipeline.
+
+struct QueuedUser
+{
+	std::string user;
+	std::size_t active = 0;
+	std::size_t waiting = 0;
+
+	template<typename Archive>
+	void serialize(Archive& ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("user", user)
+		   & zeep::make_nvp("active", active)
+		   & zeep::make_nvp("waiting", waiting);
+	}
+};
+
+struct QueueState
+{
+	int maxActive = 0;			// global capacity, zero means unlimited
+	int maxActivePerUser = 0;	// zero means unlimited
+	std::size_t active = 0;
+	std::size_t waiting = 0;
+	std::vector<QueuedUser> users;
+
+	template<typename Archive>
+	void serialize(Archive& ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("max-active", maxActive)
+		   & zeep::make_nvp("max-active-per-user", maxActivePerUser)
+		   & zeep::make_nvp("active", active)
+		   & zeep::make_nvp("waiting", waiting)
+		   & zeep::make_nvp("users", users);
+	}
+};
+
+// --------------------------------------------------------------------
+// Retention, finished runs are removed once they are too old or when
+// a user has more finished runs than allowed. Active and waiting runs
+// do not count for the quota. A value of zero disables a rule.
+
+struct RetentionPolicy
+{
+	int days = 0;				// age of ended runs
+	int stoppedDays = 0;		// age of stopped (failed) runs
+	int maxRunsPerUser = 0;		// quota on finished runs, the oldest go first
+	int batchSize = 10;			// maximum number of runs deleted per tick
+	bool dryRun = false;
+
+	bool enabled() const { return days > 0 or stoppedDays > 0 or maxRunsPerUser > 0; }
+
+	// Select the finished runs that are due for removal, along with the
+	// rule that applies. The finished runs are numbered per user, newest
+	// first, to implement the quota.
+	std::string query() const
+	{
+		std::string rules;
+
+		if (days > 0)
+			rules += " WHEN r.status = 'ended' AND coalesce(r.ended, r.created) < CURRENT_TIMESTAMP - make_interval(days => " + std::to_string(days) + ") THEN 'age'";
+
+		if (stoppedDays > 0)
+			rules += " WHEN r.status = 'stopped' AND coalesce(r.ended, r.created) < CURRENT_TIMESTAMP - make_interval(days => " + std::to_string(stoppedDays) + ") THEN 'age'";
+
+		if (maxRunsPerUser > 0)
+			rules += " WHEN r.nr > " + std::to_string(maxRunsPerUser) + " THEN 'quota'";
+
+		if (rules.empty())
+			return {};
+
+		return R"(SELECT * FROM (
+			SELECT u.name AS user, r.id, r.status, r.created, CASE)" + rules + R"( END AS reason
+			  FROM (SELECT *, row_number() OVER (PARTITION BY user_id ORDER BY created DESC, id DESC) AS nr
+					  FROM redo.run WHERE status IN ('ended', 'stopped')) r
+			  JOIN redo.user u ON r.user_id = u.id) c
+			WHERE c.reason IS NOT NULL)";
+	}
+
+	template<typename Archive>
+	void serialize(Archive& ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("days", days)
+		   & zeep::make_nvp("stopped-days", stoppedDays)
+		   & zeep::make_nvp("max-runs-per-user", maxRunsPerUser)
+		   & zeep::make_nvp("batch-size", batchSize)
+		   & zeep::make_nvp("dry-run", dryRun);
+	}
+};
+
+struct RetentionCandidate
+{
+	std::string user;
+	uint32_t id;
+	RunStatus status;
+	std::chrono::time_point<std::chrono::system_clock> date;
+	std::string reason;
+
+	template<typename Archive>
+	void serialize(Archive& ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("user", user)
+		   & zeep::make_nvp("id", id)
+		   & zeep::make_nvp("status", status)
+		   & zeep::make_nvp("date", date)
+		   & zeep::make_nvp("reason", reason);
+	}
+};
+
+struct RetentionStats
+{
+	RetentionPolicy policy;
+	std::size_t runs = 0;
+	std::size_t activeRuns = 0;
+	std::size_t candidates = 0;
+	std::optional<std::chrono::time_point<std::chrono::system_clock>> oldest;
+
+	template<typename Archive>
+	void serialize(Archive& ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("policy", policy)
+		   & zeep::make_nvp("runs", runs)
+		   & zeep::make_nvp("active-runs", activeRuns)
+		   & zeep::make_nvp("candidates", candidates)
+		   & zeep::make_nvp("oldest", oldest);
 	}
 };
 
@@ -153,17 +361,50 @@ class RunService
 	static void init(const std::string& runsDir);
 	static RunService& instance();
 
+	~RunService();
+
+	// Start and stop the background threads that keep the run registry
+	// up-to-date and remove deleted runs
+	void start();
+	void stop();
+
 	RunService(const RunService&) = delete;
 	RunService& operator=(const RunService&) = delete;
 
 	Run submit(const std::string& user, const zeep::http::file_param& pdb, const zeep::http::file_param& mtz,
-		const zeep::http::file_param& restraints, const zeep::http::file_param& sequence, const zeep::json::element& params);
+		const zeep::http::file_param& restraints, const zeep::http::file_param& sequence, const zeep::json::element& params,
+		const std::map<std::string, std::filesystem::path>& uploads = {});
+
+	std::vector<Run> submitBatch(const std::string& user, const zeep::http::file_param& pdb, const zeep::http::file_param& mtz,
+		const std::vector<zeep::http::file_param>& restraints, const std::vector<zeep::http::file_param>& sequences,
+		const zeep::json::element& runs);
 
 	std::vector<Run> getRunsForUser(const std::string& username);
 	Run getRun(const std::string& username, unsigned long runID);
-	std::vector<Run> getAllRuns();
 
-	// add a clean up routine
+	// A single archive with the results of the runs, streamed
+	std::tuple<std::istream *, std::string> getZippedRuns(const std::string& username, const std::vector<unsigned long>& runIDs,
+		const FileSelection &selection = {}, ArchiveFormat format = ArchiveFormat::ZIP);
+
+	// All runs for all users, newest first. Limited to the maxCount most recent when not zero
+	std::vector<Run> getAllRuns(std::size_t maxCount = 0);
+
+	// The state of the admission queue, users ordered by name
+	QueueState getQueueState();
+
+	// Fill in the estimated start and end time of a run that has not finished yet
+	void estimate(Run &run);
+
+	// Disk usage per user, as recorded in the run registry, largest first
+	std::vector<DiskUsage> getDiskUsage();
+	DiskUsage getDiskUsage(const std::string& username);
+
+	// The runs that the retention policy would remove, oldest first. This is
+	// what a dry run reports.
+	std::vector<RetentionCandidate> getRetentionCandidates(std::size_t maxCount = 0);
+	RetentionStats getRetentionStats();
+
+	// Deleting a run moves it to the trash, the files are removed in the background
 	void deleteRun(const std::string& username, unsigned long runID);
 
 	std::filesystem::path getRunsDir() const { return m_runsdir; }
@@ -172,6 +413,57 @@ class RunService
 
 	RunService(const std::string& runsDir);
 
+	void checkQuota(const std::string& user, std::uintmax_t additional = 0);
+	std::filesystem::path createStagingDir(const std::string& user);
+	// uses holds the number of runs still to be created for each staged
+	// file, the last of these gets the file itself, the others a link
+	Run createRun(const std::string& user, const std::vector<std::tuple<std::string, std::filesystem::path>>& input,
+		const zeep::json::element& params, std::map<std::filesystem::path, std::size_t>& uses);
+
+	// Scan the runs directory, this is the slow path used to fill the registry
+	std::vector<Run> scanAllRuns(std::size_t maxCount = 0);
+
+	// The run registry, the redo.run table
+	void storeRun(pqxx::transaction_base &tx, const Run &run);
+	void removeRun(pqxx::transaction_base &tx, const std::string &username, unsigned long runID);
+	void importRuns();
+	void updateActiveRuns();
+	void admitRuns();
+	void refreshTimings();
+	bool hasAdmissionLimits() const { return m_maxActive > 0 or m_maxActivePerUser > 0; }
+	void applyRetention();
+
+	// Wait for period, returns false when the service is stopping
+	bool idle(std::chrono::milliseconds period);
+
+	void runHousekeeping();
+	void runReaper();
+	void reapTrash();
+
 	static std::unique_ptr<RunService> s_instance;
 	std::filesystem::path m_runsdir;
+
+	std::chrono::seconds m_housekeepingInterval;
+	std::uintmax_t m_reaperRate;
+	std::uintmax_t m_userQuota;
+	int m_maxBatchSize;
+	int m_maxActive, m_maxActivePerUser;
+	RetentionPolicy m_retention;
+
+	// Rolling window of the durations of the last ended runs, from
+	// starting to running (the wait) and from running to ended.
+	std::mutex m_timings_m;
+	std::deque<std::tuple<std::chrono::seconds, std::chrono::seconds>> m_timings;
+	std::chrono::seconds m_waitSum{}, m_runSum{};
+	std::size_t m_runningCount = 0;
+	std::chrono::time_point<std::chrono::system_clock> m_timingsRefreshed;
+
+	// Set once the registry was synchronised with the runs directory,
+	// until then the listings are read from disk
+	std::atomic<bool> m_imported{ false };
+
+	bool m_done = false;
+	std::condition_variable m_cv;
+	std::mutex m_cv_m;
+	std::thread m_housekeeping, m_reaper;
 };
\ No newline at end of file
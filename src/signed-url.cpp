@@ -0,0 +1,149 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "signed-url.hpp"
+
+#include <mcfp.hpp>
+
+#include <zeep/crypto.hpp>
+#include <zeep/http/uri.hpp>
+
+#include <cassert>
+#include <stdexcept>
+
+// --------------------------------------------------------------------
+
+std::unique_ptr<SignedURLService> SignedURLService::s_instance;
+
+void SignedURLService::init(const std::string &secret, const std::string &context)
+{
+	assert(not s_instance);
+	s_instance.reset(new SignedURLService(secret, context));
+}
+
+SignedURLService &SignedURLService::instance()
+{
+	assert(s_instance);
+	return *s_instance;
+}
+
+SignedURLService::SignedURLService(const std::string &secret, const std::string &context)
+	: m_context(context)
+{
+	auto &config = mcfp::config::instance();
+
+	m_secret = config.has("download-secret") ? config.get<std::string>("download-secret") : secret;
+	m_nginx = config.get<std::string>("download-signing") == "nginx";
+	m_maxValidity = std::chrono::hours(config.get<int>("download-url-max-age"));
+
+	if (not m_context.empty() and m_context.back() == '/')
+		m_context.pop_back();
+
+	// nginx signs the path as it sees it, including the context
+	m_contextPath = m_context;
+	if (auto s = m_contextPath.find("://"); s != std::string::npos)
+	{
+		auto p = m_contextPath.find('/', s + 3);
+		m_contextPath = p == std::string::npos ? "" : m_contextPath.substr(p);
+	}
+}
+
+std::string SignedURLService::getPath(const std::string &user, unsigned long runID, const std::string &file)
+{
+	return "/signed/" + zeep::http::encode_url(user) + '/' + std::to_string(runID) + '/' + zeep::http::encode_url(file);
+}
+
+std::string SignedURLService::hmacSignature(const std::string &path, long expires) const
+{
+	return zeep::encode_base64url(zeep::hmac_sha256(path + '\n' + std::to_string(expires), m_secret));
+}
+
+// nginx uses $uri, the decoded path, so the names are not encoded here
+std::string SignedURLService::md5Signature(const std::string &user, unsigned long runID, const std::string &file, long expires) const
+{
+	auto path = "/signed/" + user + '/' + std::to_string(runID) + '/' + file;
+
+	auto s = zeep::encode_base64url(zeep::md5(std::to_string(expires) + m_contextPath + path + ' ' + m_secret));
+
+	// nginx does not expect padding
+	while (not s.empty() and s.back() == '=')
+		s.pop_back();
+
+	return s;
+}
+
+SignedURL SignedURLService::sign(const std::string &user, unsigned long runID, const std::string &file, std::chrono::seconds validity)
+{
+	using namespace std::chrono;
+
+	if (validity <= seconds(0) or validity > m_maxValidity)
+		validity = m_maxValidity;
+
+	auto expires = time_point_cast<seconds>(system_clock::now() + validity);
+	auto e = expires.time_since_epoch().count();
+
+	auto path = getPath(user, runID, file);
+
+	SignedURL result;
+	result.expires = expires;
+	result.url = m_context + path + "?expires=" + std::to_string(e) +
+				 (m_nginx ? "&md5=" + md5Signature(user, runID, file, e) : "&signature=" + hmacSignature(path, e));
+
+	return result;
+}
+
+bool SignedURLService::verify(const std::string &user, unsigned long runID, const std::string &file,
+	long expires, const std::string &signature, const std::string &md5) const
+{
+	using namespace std::chrono;
+
+	if (expires < duration_cast<seconds>(system_clock::now().time_since_epoch()).count())
+		return false;
+
+	std::string expected, provided;
+	if (not signature.empty())
+	{
+		expected = hmacSignature(getPath(user, runID, file), expires);
+		provided = signature;
+	}
+	else if (not md5.empty())
+	{
+		expected = md5Signature(user, runID, file, expires);
+		provided = md5;
+	}
+	else
+		return false;
+
+	// compare in constant time
+	if (expected.length() != provided.length())
+		return false;
+
+	unsigned char d = 0;
+	for (std::size_t i = 0; i < expected.length(); ++i)
+		d |= expected[i] ^ provided[i];
+
+	return d == 0;
+}
@@ -0,0 +1,89 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <zeep/nvp.hpp>
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+// --------------------------------------------------------------------
+// Signed, time limited URLs for downloading run result files without
+// the regular authentication. The signature covers the path and the
+// expiry time, checking it needs no state besides the secret.
+//
+// In nginx mode the signature is the one expected by the nginx
+// secure_link module, configured as:
+//
+//   secure_link $arg_md5,$arg_expires;
+//   secure_link_md5 "$secure_link_expires$uri <secret>";
+//
+// nginx hashes $uri, which is the decoded path. The md5 is therefore
+// computed over the path before URL encoding, e.g. with a space where the
+// URL contains %20. The hmac signature covers the encoded path.
+
+struct SignedURL
+{
+	std::string url;
+	std::chrono::time_point<std::chrono::system_clock> expires;
+
+	template <typename Archive>
+	void serialize(Archive &ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("url", url)
+		   & zeep::make_nvp("expires", expires);
+	}
+};
+
+class SignedURLService
+{
+  public:
+	static void init(const std::string &secret, const std::string &context);
+	static SignedURLService &instance();
+
+	// The path to use for a result file of a run, relative to the context
+	static std::string getPath(const std::string &user, unsigned long runID, const std::string &file);
+
+	SignedURL sign(const std::string &user, unsigned long runID, const std::string &file, std::chrono::seconds validity);
+
+	// Check the signature for a result file and expiry, either one of signature or md5 should be specified
+	bool verify(const std::string &user, unsigned long runID, const std::string &file,
+		long expires, const std::string &signature, const std::string &md5) const;
+
+  private:
+	SignedURLService(const std::string &secret, const std::string &context);
+
+	std::string hmacSignature(const std::string &path, long expires) const;
+	std::string md5Signature(const std::string &user, unsigned long runID, const std::string &file, long expires) const;
+
+	static std::unique_ptr<SignedURLService> s_instance;
+
+	std::string m_secret, m_context, m_contextPath;
+	bool m_nginx;
+	std::chrono::seconds m_maxValidity;
+};
@@ -0,0 +1,333 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stats-service.hpp"
+
+#include <mcfp.hpp>
+
+#include <zeep/unicode-support.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+// --------------------------------------------------------------------
+
+std::tuple<std::size_t, std::size_t> StatsTable::nearest(double ureso, std::size_t count) const
+{
+	const std::size_t n = size();
+
+	std::size_t b = std::lower_bound(URESO.begin(), URESO.end(), ureso) - URESO.begin();
+	std::size_t e = b;
+
+	// Grow the window on the side of the closest next row
+	while (e - b < count and (b > 0 or e < n))
+	{
+		if (b == 0)
+			++e;
+		else if (e == n)
+			--b;
+		else if (ureso - URESO[b - 1] <= URESO[e] - ureso)
+			--b;
+		else
+			++e;
+	}
+
+	// Include all rows with the same resolution as the outer ones
+	while (b > 0 and b < n and URESO[b - 1] == URESO[b])
+		--b;
+
+	while (e > 0 and e < n and URESO[e] == URESO[e - 1])
+		++e;
+
+	return { b, e };
+}
+
+// --------------------------------------------------------------------
+
+StatsService &StatsService::instance()
+{
+	static StatsService s_instance;
+	return s_instance;
+}
+
+StatsService::StatsService()
+{
+	auto &config = mcfp::config::instance();
+	m_file = fs::path(config.get<std::string>("pdb-redo-tools-dir")) / "pdb_redo_stats.csv";
+}
+
+std::shared_ptr<const StatsTable> StatsService::getTable()
+{
+	std::error_code ec;
+	auto mtime = fs::last_write_time(m_file, ec);
+
+	std::unique_lock lock(m_mutex);
+
+	if (ec)
+	{
+		// Keep using what was loaded before when the file is being replaced
+		if (not m_table)
+			throw std::runtime_error("Could not open statistics file");
+	}
+	else if (not m_table or mtime != m_mtime)
+	{
+		m_table = load(m_file);
+		m_mtime = mtime;
+		m_summaries.clear();
+		m_bins.clear();
+	}
+
+	return m_table;
+}
+
+std::shared_ptr<const StatsTable> StatsService::load(const fs::path &file)
+{
+	std::ifstream f(file);
+	if (not f.is_open())
+		throw std::runtime_error("Could not open statistics file");
+
+	std::string line;
+	getline(f, line); // skip first
+
+	std::vector<Stats> stats;
+
+	while (getline(f, line))
+	{
+		std::vector<std::string> fld;
+		zeep::split(fld, line, ",");
+		if (fld.size() != 7)
+			continue;
+		stats.emplace_back(stod(fld[0]), stod(fld[1]), stod(fld[2]), stod(fld[3]), stod(fld[4]), stod(fld[5]), stod(fld[6]));
+	}
+
+	std::stable_sort(stats.begin(), stats.end(), [](const Stats &a, const Stats &b)
+		{ return a.URESO < b.URESO; });
+
+	auto result = std::make_shared<StatsTable>();
+
+	for (auto c : { &result->RFREE, &result->RFFIN, &result->OZRAMA, &result->FZRAMA, &result->OCHI12, &result->FCHI12, &result->URESO })
+		c->reserve(stats.size());
+
+	for (auto &s : stats)
+	{
+		result->RFREE.push_back(s.RFREE);
+		result->RFFIN.push_back(s.RFFIN);
+		result->OZRAMA.push_back(s.OZRAMA);
+		result->FZRAMA.push_back(s.FZRAMA);
+		result->OCHI12.push_back(s.OCHI12);
+		result->FCHI12.push_back(s.FCHI12);
+		result->URESO.push_back(s.URESO);
+	}
+
+	return result;
+}
+
+std::vector<Stats> StatsService::getNearest(double ureso, std::size_t count)
+{
+	auto table = getTable();
+
+	auto [b, e] = table->nearest(ureso, count);
+
+	std::vector<Stats> result;
+	result.reserve(e - b);
+
+	for (auto i = b; i < e; ++i)
+		result.push_back((*table)[i]);
+
+	return result;
+}
+
+StatsSummary StatsService::getSummary(double ureso, std::size_t count)
+{
+	auto table = getTable();
+
+	auto range = table->nearest(ureso, count);
+
+	{
+		std::unique_lock lock(m_mutex);
+
+		// the table may have been reloaded in the mean time
+		if (table == m_table)
+		{
+			if (auto i = m_summaries.find(range); i != m_summaries.end())
+				return i->second;
+		}
+	}
+
+	auto [b, e] = range;
+
+	StatsSummary result{
+		e - b,
+		summarize(table->RFREE, b, e),
+		summarize(table->RFFIN, b, e),
+		summarize(table->OZRAMA, b, e),
+		summarize(table->FZRAMA, b, e),
+		summarize(table->OCHI12, b, e),
+		summarize(table->FCHI12, b, e)
+	};
+
+	std::unique_lock lock(m_mutex);
+
+	if (table == m_table)
+	{
+		if (m_summaries.size() >= kMaxCachedSummaries)
+			m_summaries.clear();
+		m_summaries.emplace(range, result);
+	}
+
+	return result;
+}
+
+BoxPlotSummary StatsService::summarize(const std::vector<double> &column, std::size_t b, std::size_t e)
+{
+	BoxPlotSummary result{};
+
+	if (b == e)
+		return result;
+
+	std::vector<double> v(column.begin() + b, column.begin() + e);
+	const std::size_t n = v.size();
+
+	auto [mini, maxi] = std::minmax_element(v.begin(), v.end());
+	result.min = *mini;
+	result.max = *maxi;
+
+	// Select the quartiles one after the other, each selection only
+	// has to look at the part after the previous one.
+	auto first = v.begin();
+	for (double p : { 0.25, 0.5, 0.75 })
+	{
+		double h = (n - 1) * p;
+		auto i = static_cast<std::size_t>(h);
+
+		std::nth_element(first, v.begin() + i, v.end());
+		first = v.begin() + i;
+
+		double q = v[i];
+		if (i + 1 < n)
+			q += (*std::min_element(v.begin() + i + 1, v.end()) - q) * (h - i);
+
+		result.quartiles.push_back(q);
+	}
+
+	double iqr = result.quartiles[2] - result.quartiles[0];
+	double lo = std::max(result.min, result.quartiles[0] - iqr * 1.5);
+	double hi = std::min(result.max, result.quartiles[2] + iqr * 1.5);
+
+	result.whiskers = { lo, hi };
+
+	for (auto d : v)
+	{
+		if (d < lo or d > hi)
+			result.outliers.push_back(d);
+	}
+
+	return result;
+}
+
+// --------------------------------------------------------------------
+
+std::shared_ptr<const StatsService::StatsBin> StatsService::getBin(double ureso)
+{
+	auto table = getTable();
+
+	long bin = std::lround(ureso / kBinWidth);
+
+	{
+		std::unique_lock lock(m_mutex);
+
+		if (table == m_table)
+		{
+			if (auto i = m_bins.find(bin); i != m_bins.end())
+				return i->second;
+		}
+	}
+
+	auto [b, e] = table->nearest(bin * kBinWidth, kBinRowCount);
+
+	auto result = std::make_shared<StatsBin>();
+
+	for (auto [column, sorted] : {
+			 std::make_tuple(&StatsTable::RFREE, &StatsBin::RFREE),
+			 std::make_tuple(&StatsTable::RFFIN, &StatsBin::RFFIN),
+			 std::make_tuple(&StatsTable::OZRAMA, &StatsBin::OZRAMA),
+			 std::make_tuple(&StatsTable::FZRAMA, &StatsBin::FZRAMA),
+			 std::make_tuple(&StatsTable::OCHI12, &StatsBin::OCHI12),
+			 std::make_tuple(&StatsTable::FCHI12, &StatsBin::FCHI12) })
+	{
+		auto &c = (*table).*column;
+		auto &v = (*result).*sorted;
+
+		v.assign(c.begin() + b, c.begin() + e);
+		std::sort(v.begin(), v.end());
+	}
+
+	std::unique_lock lock(m_mutex);
+
+	if (table == m_table)
+		m_bins.emplace(bin, result);
+
+	return result;
+}
+
+std::optional<StatsPercentiles> StatsService::getPercentiles(const zeep::json::element &data)
+{
+	if (not data["URESO"].is_number())
+		return {};
+
+	auto bin = getBin(data["URESO"].as<double>());
+
+	auto percentile = [&data](const char *name, const std::vector<double> &sorted, bool higherIsWorse) -> std::optional<double>
+	{
+		if (sorted.empty() or not data[name].is_number())
+			return {};
+
+		double value = data[name].as<double>();
+
+		auto lower = std::lower_bound(sorted.begin(), sorted.end(), value);
+		auto upper = std::upper_bound(lower, sorted.end(), value);
+
+		double below = lower - sorted.begin();
+		double equal = upper - lower;
+		double above = sorted.end() - upper;
+
+		// ties count as half worse
+		return 100 * ((higherIsWorse ? above : below) + equal / 2) / sorted.size();
+	};
+
+	return StatsPercentiles{
+		percentile("RFREE", bin->RFREE, true),
+		percentile("RFFIN", bin->RFFIN, true),
+		percentile("OZRAMA", bin->OZRAMA, false),
+		percentile("FZRAMA", bin->FZRAMA, false),
+		percentile("OCHI12", bin->OCHI12, false),
+		percentile("FCHI12", bin->FCHI12, false)
+	};
+}
@@ -0,0 +1,199 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <zeep/nvp.hpp>
+#include <zeep/json/element.hpp>
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+// --------------------------------------------------------------------
+
+struct Stats
+{
+	double RFREE, RFFIN, OZRAMA, FZRAMA, OCHI12, FCHI12, URESO;
+
+	Stats() {}
+	Stats(double RFREE, double RFFIN, double OZRAMA, double FZRAMA, double OCHI12, double FCHI12, double URESO)
+		: RFREE(RFREE), RFFIN(RFFIN), OZRAMA(OZRAMA), FZRAMA(FZRAMA), OCHI12(OCHI12), FCHI12(FCHI12), URESO(URESO) {}
+	
+	Stats(const Stats &) = default;
+	Stats &operator=(const Stats &) = default;
+
+	template <typename Archive>
+	void serialize(Archive &ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("RFREE", RFREE)
+		   & zeep::make_nvp("RFFIN", RFFIN)
+		   & zeep::make_nvp("OZRAMA", OZRAMA)
+		   & zeep::make_nvp("FZRAMA", FZRAMA)
+		   & zeep::make_nvp("OCHI12", OCHI12)
+		   & zeep::make_nvp("FCHI12", FCHI12)
+		   & zeep::make_nvp("URESO", URESO);
+	}
+};
+
+// --------------------------------------------------------------------
+// The numbers needed to draw a box plot for one column, the quartiles
+// are interpolated as d3.quantile does. Whiskers extend at most 1.5 times
+// the interquartile range, values outside the whiskers are outliers.
+
+struct BoxPlotSummary
+{
+	double min, max;
+	std::vector<double> quartiles, whiskers, outliers;
+
+	template <typename Archive>
+	void serialize(Archive &ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("min", min)
+		   & zeep::make_nvp("max", max)
+		   & zeep::make_nvp("quartiles", quartiles)
+		   & zeep::make_nvp("whiskers", whiskers)
+		   & zeep::make_nvp("outliers", outliers);
+	}
+};
+
+struct StatsSummary
+{
+	std::size_t count;
+	BoxPlotSummary RFREE, RFFIN, OZRAMA, FZRAMA, OCHI12, FCHI12;
+
+	template <typename Archive>
+	void serialize(Archive &ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("count", count)
+		   & zeep::make_nvp("RFREE", RFREE)
+		   & zeep::make_nvp("RFFIN", RFFIN)
+		   & zeep::make_nvp("OZRAMA", OZRAMA)
+		   & zeep::make_nvp("FZRAMA", FZRAMA)
+		   & zeep::make_nvp("OCHI12", OCHI12)
+		   & zeep::make_nvp("FCHI12", FCHI12);
+	}
+};
+
+// --------------------------------------------------------------------
+// The percentage of structures at a similar resolution that have a worse
+// score. For the R-free values higher is worse, for the Z-scores lower.
+
+struct StatsPercentiles
+{
+	std::optional<double> RFREE, RFFIN, OZRAMA, FZRAMA, OCHI12, FCHI12;
+
+	template <typename Archive>
+	void serialize(Archive &ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("RFREE", RFREE)
+		   & zeep::make_nvp("RFFIN", RFFIN)
+		   & zeep::make_nvp("OZRAMA", OZRAMA)
+		   & zeep::make_nvp("FZRAMA", FZRAMA)
+		   & zeep::make_nvp("OCHI12", OCHI12)
+		   & zeep::make_nvp("FCHI12", FCHI12);
+	}
+};
+
+// --------------------------------------------------------------------
+// The contents of pdb_redo_stats.csv, stored per column and sorted by
+// URESO so that rows with a similar resolution are adjacent.
+
+struct StatsTable
+{
+	std::vector<double> RFREE, RFFIN, OZRAMA, FZRAMA, OCHI12, FCHI12, URESO;
+
+	std::size_t size() const
+	{
+		return URESO.size();
+	}
+
+	Stats operator[](std::size_t i) const
+	{
+		return { RFREE[i], RFFIN[i], OZRAMA[i], FZRAMA[i], OCHI12[i], FCHI12[i], URESO[i] };
+	}
+
+	// The range [begin, end) of the count rows with a URESO closest to
+	// ureso, extended with rows having the same URESO as the outer ones.
+	std::tuple<std::size_t, std::size_t> nearest(double ureso, std::size_t count) const;
+};
+
+class StatsService
+{
+  public:
+	static StatsService &instance();
+
+	// The current table, reloaded when the file has changed
+	std::shared_ptr<const StatsTable> getTable();
+
+	// The rows of the entries with a resolution close to ureso
+	std::vector<Stats> getNearest(double ureso, std::size_t count = 1000);
+
+	// The box plot summaries for the same rows
+	StatsSummary getSummary(double ureso, std::size_t count = 1000);
+
+	// The percentiles for the values in data, an object as found in the
+	// properties of data.json. Empty if data contains no URESO.
+	std::optional<StatsPercentiles> getPercentiles(const zeep::json::element &data);
+
+	// The statistics file, pdb_redo_stats.csv
+	const std::filesystem::path &getFile() const { return m_file; }
+
+  private:
+	StatsService();
+
+	static std::shared_ptr<const StatsTable> load(const std::filesystem::path &file);
+
+	static BoxPlotSummary summarize(const std::vector<double> &column, std::size_t b, std::size_t e);
+
+	// The sorted values of each column for the rows nearest to the
+	// centre of a resolution bin
+	struct StatsBin
+	{
+		std::vector<double> RFREE, RFFIN, OZRAMA, FZRAMA, OCHI12, FCHI12;
+	};
+
+	static constexpr double kBinWidth = 0.1;
+	static constexpr std::size_t kBinRowCount = 1000;
+
+	std::shared_ptr<const StatsBin> getBin(double ureso);
+
+	std::filesystem::path m_file;
+	std::mutex m_mutex;
+	std::shared_ptr<const StatsTable> m_table;
+	std::filesystem::file_time_type m_mtime;
+
+	// Summaries for the current table by row range, many resolutions
+	// share the same range of nearest rows.
+	static constexpr std::size_t kMaxCachedSummaries = 1024;
+	std::map<std::tuple<std::size_t, std::size_t>, StatsSummary> m_summaries;
+
+	std::map<long, std::shared_ptr<const StatsBin>> m_bins;
+};
@@ -0,0 +1,236 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "upload-service.hpp"
+
+#include <mcfp.hpp>
+
+#include <zeep/crypto.hpp>
+#include <zeep/json/parser.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <regex>
+
+namespace fs = std::filesystem;
+
+// --------------------------------------------------------------------
+
+UploadService &UploadService::instance()
+{
+	static UploadService s_instance;
+	return s_instance;
+}
+
+UploadService::UploadService()
+{
+	auto &config = mcfp::config::instance();
+
+	m_dir = fs::path(config.get<std::string>("runs-dir")) / ".uploads" / "chunked";
+	m_lifetime = std::chrono::hours(config.get<int>("upload-lifetime"));
+}
+
+fs::path UploadService::getDir(const std::string &id) const
+{
+	const std::regex rx("[0-9a-f]{32}");
+
+	if (not std::regex_match(id, rx))
+		throw std::runtime_error("Invalid upload id");
+
+	return m_dir / id;
+}
+
+void UploadService::store(const UploadInfo &info)
+{
+	auto dir = getDir(info.id);
+
+	zeep::json::element e;
+	to_element(e, info);
+
+	// write a new file and move it in place, readers never see a partial file
+	std::ofstream out(dir / "info.json.tmp");
+	out << e;
+	out.close();
+
+	fs::rename(dir / "info.json.tmp", dir / "info.json");
+}
+
+UploadInfo UploadService::create(const std::string &user, const std::string &filename, std::optional<std::uintmax_t> size)
+{
+	const std::regex rx("[-a-zA-Z0-9+_().]+");
+
+	std::random_device rng;
+	std::ostringstream id;
+	for (int i = 0; i < 4; ++i)
+		id << std::hex << std::setw(8) << std::setfill('0') << rng();
+
+	UploadInfo info;
+	info.id = id.str();
+	info.user = user;
+	info.filename = std::regex_match(filename, rx) ? filename : "upload";
+	info.size = size;
+	info.created = std::chrono::system_clock::now();
+
+	auto dir = getDir(info.id);
+	fs::create_directories(dir);
+
+	std::ofstream data(dir / "data", std::ios::binary);
+	data.close();
+
+	store(info);
+
+	return info;
+}
+
+UploadInfo UploadService::get(const std::string &user, const std::string &id)
+{
+	auto dir = getDir(id);
+
+	std::ifstream in(dir / "info.json");
+	if (not in.is_open())
+		throw std::runtime_error("Upload not found");
+
+	zeep::json::element e;
+	zeep::json::parse_json(in, e);
+
+	UploadInfo info;
+	from_element(e, info);
+
+	if (info.user != user)
+		throw std::runtime_error("Upload not found");
+
+	return info;
+}
+
+UploadInfo UploadService::putChunk(const std::string &user, const std::string &id, std::uintmax_t offset,
+	const zeep::http::file_param &chunk, const std::string &sha256)
+{
+	std::lock_guard lock(m_mutex);
+
+	auto info = get(user, id);
+
+	if (info.complete)
+		throw std::runtime_error("Upload was already finalized");
+
+	if (offset > info.received)
+		throw std::runtime_error("Chunk offset " + std::to_string(offset) + " is beyond the " + std::to_string(info.received) + " bytes received so far");
+
+	if (info.size.has_value() and offset + chunk.length > *info.size)
+		throw std::runtime_error("Chunk exceeds the size of the upload");
+
+	auto digest = zeep::encode_base64(zeep::sha256(std::string(chunk.data, chunk.length)));
+	if (not sha256.empty() and digest != sha256)
+		throw std::runtime_error("Checksum mismatch for the chunk at offset " + std::to_string(offset));
+
+	auto file = getDir(id) / "data";
+
+	std::fstream out(file, std::ios::in | std::ios::out | std::ios::binary);
+	out.seekp(offset);
+	out.write(chunk.data, chunk.length);
+	out.close();
+
+	if (out.fail())
+		throw std::runtime_error("Could not write chunk");
+
+	// a chunk replaces whatever was received after its offset
+	fs::resize_file(file, offset + chunk.length);
+
+	info.chunks.erase(std::remove_if(info.chunks.begin(), info.chunks.end(),
+		[offset](const UploadChunk &c) { return c.offset >= offset; }), info.chunks.end());
+
+	info.chunks.push_back({ offset, chunk.length, digest });
+	info.received = offset + chunk.length;
+
+	store(info);
+
+	return info;
+}
+
+UploadInfo UploadService::finalize(const std::string &user, const std::string &id)
+{
+	std::lock_guard lock(m_mutex);
+
+	auto info = get(user, id);
+
+	if (not info.complete)
+	{
+		if (info.size.has_value() and info.received != *info.size)
+			throw std::runtime_error("Upload is incomplete, received " + std::to_string(info.received) + " of " + std::to_string(*info.size) + " bytes");
+
+		auto dir = getDir(id);
+		fs::create_directories(dir / "file");
+		fs::rename(dir / "data", dir / "file" / info.filename);
+
+		info.complete = true;
+		store(info);
+	}
+
+	return info;
+}
+
+void UploadService::remove(const std::string &user, const std::string &id)
+{
+	get(user, id);
+
+	fs::remove_all(getDir(id));
+}
+
+fs::path UploadService::getFile(const std::string &user, const std::string &id)
+{
+	auto info = get(user, id);
+
+	if (not info.complete)
+		throw std::runtime_error("Upload " + id + " was not finalized");
+
+	return getDir(id) / "file" / info.filename;
+}
+
+void UploadService::expire()
+{
+	std::error_code ec;
+	if (not fs::exists(m_dir, ec))
+		return;
+
+	auto now = fs::file_time_type::clock::now();
+
+	for (auto i = fs::directory_iterator(m_dir, ec); not ec and i != fs::directory_iterator(); i.increment(ec))
+	{
+		// the info file is rewritten on each chunk, so its age is the time of the last activity
+		auto t = fs::last_write_time(i->path() / "info.json", ec);
+		if (ec)
+			t = fs::last_write_time(i->path(), ec);
+
+		if (not ec and now - t > m_lifetime)
+		{
+			fs::remove_all(i->path(), ec);
+			if (ec)
+				std::cerr << "Could not remove expired upload " << i->path() << ": " << ec.message() << std::endl;
+		}
+	}
+}
@@ -0,0 +1,118 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <zeep/http/request.hpp>
+#include <zeep/nvp.hpp>
+
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------------------
+// Resumable uploads. A client creates an upload session, sends the file
+// in chunks and then finalizes the upload. The id of a finalized upload
+// can be used in place of the file data when submitting a run.
+
+struct UploadChunk
+{
+	std::uintmax_t offset;
+	std::uintmax_t length;
+	std::string sha256;
+
+	template <typename Archive>
+	void serialize(Archive &ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("offset", offset)
+		   & zeep::make_nvp("length", length)
+		   & zeep::make_nvp("sha256", sha256);
+	}
+};
+
+struct UploadInfo
+{
+	std::string id;
+	std::string user;
+	std::string filename;
+	std::optional<std::uintmax_t> size;
+	std::uintmax_t received = 0;
+	bool complete = false;
+	std::chrono::time_point<std::chrono::system_clock> created;
+	std::vector<UploadChunk> chunks;
+
+	template <typename Archive>
+	void serialize(Archive &ar, unsigned long version)
+	{
+		ar & zeep::make_nvp("id", id)
+		   & zeep::make_nvp("user", user)
+		   & zeep::make_nvp("filename", filename)
+		   & zeep::make_nvp("size", size)
+		   & zeep::make_nvp("received", received)
+		   & zeep::make_nvp("complete", complete)
+		   & zeep::make_nvp("created", created)
+		   & zeep::make_nvp("chunks", chunks);
+	}
+};
+
+class UploadService
+{
+  public:
+	static UploadService &instance();
+
+	UploadInfo create(const std::string &user, const std::string &filename, std::optional<std::uintmax_t> size);
+	UploadInfo get(const std::string &user, const std::string &id);
+
+	// Write a chunk at offset. The offset may not be beyond the data received
+	// so far, a chunk at an earlier offset replaces everything after it.
+	UploadInfo putChunk(const std::string &user, const std::string &id, std::uintmax_t offset,
+		const zeep::http::file_param &chunk, const std::string &sha256);
+
+	UploadInfo finalize(const std::string &user, const std::string &id);
+	void remove(const std::string &user, const std::string &id);
+
+	// The file of a finalized upload, named after the uploaded file
+	std::filesystem::path getFile(const std::string &user, const std::string &id);
+
+	// Remove uploads that were not used in time
+	void expire();
+
+  private:
+	UploadService();
+
+	UploadService(const UploadService &) = delete;
+	UploadService &operator=(const UploadService &) = delete;
+
+	std::filesystem::path getDir(const std::string &id) const;
+	void store(const UploadInfo &info);
+
+	std::filesystem::path m_dir;
+	std::chrono::hours m_lifetime;
+	std::mutex m_mutex;
+};
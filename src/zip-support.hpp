@@ -26,9 +26,19 @@
 
 #pragma once
 
-#include <memory>
-#include <sstream>
+#include <cassert>
 #include <filesystem>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <fnmatch.h>
 
 #include <gxrio.hpp>
 
@@ -36,88 +46,352 @@
 #include <archive.h>
 #include <archive_entry.h>
 
-class ZipWriter
+// --------------------------------------------------------------------
+// Selection of files for an archive using comma separated glob patterns,
+// white space around the patterns is ignored.
+// A pattern containing a slash is matched against the relative path of
+// a file, other patterns against the file name and each directory name.
+// Without include patterns all files are included, exclude wins.
+
+class FileSelection
+{
+  public:
+	FileSelection() = default;
+
+	FileSelection(const std::optional<std::string> &include, const std::optional<std::string> &exclude)
+		: m_include(split(include))
+		, m_exclude(split(exclude))
+	{
+	}
+
+	bool empty() const
+	{
+		return m_include.empty() and m_exclude.empty();
+	}
+
+	bool operator()(const std::filesystem::path &file) const
+	{
+		return (m_include.empty() or matches(m_include, file)) and not matches(m_exclude, file);
+	}
+
+  private:
+	static std::vector<std::string> split(const std::optional<std::string> &patterns)
+	{
+		std::vector<std::string> result;
+
+		if (patterns)
+		{
+			std::string::size_type b = 0;
+			for (;;)
+			{
+				auto e = patterns->find(',', b);
+				auto p = patterns->substr(b, e == std::string::npos ? std::string::npos : e - b);
+
+				// "*.cif, *.mtz" is a common way to write a list
+				const char kSpace[] = " \t\r\n";
+				auto f = p.find_first_not_of(kSpace);
+				if (f != std::string::npos)
+					result.emplace_back(p.substr(f, p.find_last_not_of(kSpace) - f + 1));
+
+				if (e == std::string::npos)
+					break;
+
+				b = e + 1;
+			}
+		}
+
+		return result;
+	}
+
+	static bool matches(const std::vector<std::string> &patterns, const std::filesystem::path &file)
+	{
+		for (auto &pattern : patterns)
+		{
+			if (pattern.find('/') != std::string::npos)
+			{
+				if (fnmatch(pattern.c_str(), file.generic_string().c_str(), FNM_PATHNAME) == 0)
+					return true;
+				continue;
+			}
+
+			for (auto &part : file)
+			{
+				if (fnmatch(pattern.c_str(), part.c_str(), 0) == 0)
+					return true;
+			}
+		}
+
+		return false;
+	}
+
+	std::vector<std::string> m_include, m_exclude;
+};
+
+// --------------------------------------------------------------------
+// The supported archive formats. tar.zst is a lot faster to create and
+// to unpack than zip with deflate, zip is the default since it is what
+// most users can open.
+
+enum class ArchiveFormat
+{
+	ZIP,
+	TAR_ZSTD
+};
+
+// Select the format from a format parameter or else the accept header
+inline ArchiveFormat selectArchiveFormat(const std::optional<std::string> &format, const std::string &accept = {})
+{
+	if (format)
+	{
+		if (*format == "zip")
+			return ArchiveFormat::ZIP;
+		if (*format == "tar.zst" or *format == "tar.zstd")
+			return ArchiveFormat::TAR_ZSTD;
+		throw std::runtime_error("Unsupported archive format " + *format);
+	}
+
+	if (accept.find("application/zstd") != std::string::npos or accept.find("application/x-zstd") != std::string::npos)
+		return ArchiveFormat::TAR_ZSTD;
+
+	return ArchiveFormat::ZIP;
+}
+
+inline std::string archiveExtension(ArchiveFormat format)
+{
+	return format == ArchiveFormat::TAR_ZSTD ? ".tar.zst" : ".zip";
+}
+
+inline std::string archiveContentType(ArchiveFormat format)
+{
+	return format == ArchiveFormat::TAR_ZSTD ? "application/zstd" : "application/zip";
+}
+
+// --------------------------------------------------------------------
+// An archive that is created while it is being read. Files are only
+// opened and compressed when the reader asks for more data, so memory
+// use does not depend on the size of the archive.
+
+class ArchiveStreambuf : public std::streambuf
 {
   public:
-	ZipWriter()
-		: m_s(new std::stringstream)
+	ArchiveStreambuf(ArchiveFormat format)
+		: m_format(format)
 	{
+		m_buffer.reserve(kBufferSize);
+
 		m_a = archive_write_new();
-		archive_write_set_format_zip(m_a);
-		archive_write_open(m_a, this, &open_cb, &write_cb, &close_cb);
+
+		if (m_format == ArchiveFormat::TAR_ZSTD)
+		{
+			archive_write_set_format_pax_restricted(m_a);
+			archive_write_add_filter_zstd(m_a);
+
+			auto level = std::to_string(s_zstd_level);
+			archive_write_set_filter_option(m_a, "zstd", "compression-level", level.c_str());
+
+			// Not supported by older versions of libarchive, single threaded then
+			auto threads = std::to_string(s_zstd_threads);
+			archive_write_set_filter_option(m_a, "zstd", "threads", threads.c_str());
+		}
+		else
+			archive_write_set_format_zip(m_a);
+
+		archive_write_set_bytes_in_last_block(m_a, 1);
+
+		if (archive_write_open(m_a, this, nullptr, &write_cb, nullptr) != ARCHIVE_OK)
+		{
+			std::string msg = "Could not create archive: " + errorString();
+			archive_write_free(m_a);
+			throw std::runtime_error(msg);
+		}
 	}
 
-	~ZipWriter()
+	~ArchiveStreambuf()
 	{
 		archive_write_free(m_a);
 	}
 
+	ArchiveStreambuf(const ArchiveStreambuf &) = delete;
+	ArchiveStreambuf &operator=(const ArchiveStreambuf &) = delete;
+
+	// Add file to the archive as name. Compressed files (.gz) are
+	// stored decompressed in zip archives.
 	void add(std::filesystem::path file, std::filesystem::path name)
 	{
-		gxrio::ifstream in(file);
+		m_entries.emplace_back(std::move(file), std::move(name));
+	}
 
-		bool compressed = file.extension() == ".gz";
-		assert(compressed == (name.extension() == ".gz"));
+	bool empty() const
+	{
+		return m_entries.empty();
+	}
 
-		std::vector<char> data;
+	// zstd settings for tar.zst archives, threads zero means one per core
+	static void setZstdOptions(int level, int threads)
+	{
+		s_zstd_level = level;
+		s_zstd_threads = threads;
+	}
 
-		if (compressed)
-			name.replace_extension();
+  protected:
+	int_type underflow() override
+	{
+		while (gptr() == egptr())
+		{
+			m_buffer.clear();
+
+			if (m_done)
+				return traits_type::eof();
+
+			next();
+
+			setg(m_buffer.data(), m_buffer.data(), m_buffer.data() + m_buffer.size());
+		}
+
+		return traits_type::to_int_type(*gptr());
+	}
+
+  private:
+	static constexpr std::size_t kBufferSize = 256 * 1024;
+
+	std::string errorString()
+	{
+		auto msg = archive_error_string(m_a);
+		return msg ? msg : "unknown error";
+	}
+
+	// Failures end the archive, an exception thrown here makes the
+	// reading stream go bad and the download is cut off. Warnings are
+	// not fatal.
+	void check(int r, const char *what)
+	{
+		if (r < ARCHIVE_WARN)
+			fail(what);
+	}
+
+	[[noreturn]] void fail(const char *what)
+	{
+		m_done = true;
+		m_in.reset();
+		throw std::runtime_error(std::string("Error creating archive, ") + what + ": " + errorString());
+	}
 
-		for (;;)
+	// Do the next bit of work: start an entry, copy some data or finish
+	void next()
+	{
+		if (not m_in)
+		{
+			if (m_next < m_entries.size())
+			{
+				auto &[file, name] = m_entries[m_next++];
+				openEntry(file, name);
+			}
+			else
+			{
+				m_done = true;
+				check(archive_write_close(m_a), "closing archive");
+			}
+		}
+		else
 		{
-			char buffer[10240];
-			auto n = in.rdbuf()->sgetn(buffer, sizeof(buffer));
+			char buffer[kBufferSize / 4];
+			auto n = m_in->rdbuf()->sgetn(buffer, sizeof(buffer));
+
+			if (n > 0)
+			{
+				// returns the number of bytes written, or a negative value on error
+				if (archive_write_data(m_a, buffer, n) < 0)
+					fail("writing data");
+			}
+			else
+			{
+				m_in.reset();
+				check(archive_write_finish_entry(m_a), "finishing entry");
+			}
+		}
+	}
 
-			if (n == 0)
-				break;
+	void openEntry(const std::filesystem::path &file, std::filesystem::path name)
+	{
+		// A tar header contains the size of the data, the decompressed
+		// size of a .gz file is not known in advance so those are stored
+		// as is in a tar.
+		bool decompress = m_format == ArchiveFormat::ZIP and file.extension() == ".gz";
+		assert(file.extension() == name.extension());
 
-			data.insert(data.end(), buffer, buffer + n);
+		if (decompress)
+		{
+			name.replace_extension();
+			m_in.reset(new gxrio::ifstream(file));
+		}
+		else
+			m_in.reset(new std::ifstream(file, std::ios::binary));
+
+		if (not *m_in)
+		{
+			m_in.reset();
+			m_done = true;
+			throw std::runtime_error("Error creating archive, could not open " + file.string());
 		}
 
 		auto entry = archive_entry_new();
 		archive_entry_set_pathname(entry, name.c_str());
 		archive_entry_set_filetype(entry, AE_IFREG);
 		archive_entry_set_perm(entry, 0644);
-		archive_entry_set_size(entry, data.size());
-		archive_write_header(m_a, entry);
 
-		archive_write_data(m_a, data.data(), data.size());
+		// The zip writer stores the size after the data when it is unset
+		std::error_code ec;
+		auto size = std::filesystem::file_size(file, ec);
+		if (not decompress and not ec)
+			archive_entry_set_size(entry, size);
 
+		auto r = archive_write_header(m_a, entry);
 		archive_entry_free(entry);
-	}
-
-	std::istream *finish()
-	{
-		archive_write_close(m_a);
 
-		return m_s.release();
+		check(r, "writing header");
 	}
 
-  private:
-	static int open_cb(struct archive *a, void *self)
+	static la_ssize_t write_cb(struct archive *a, void *self, const void *buffer, size_t length)
 	{
-		return ARCHIVE_OK;
+		auto asb = static_cast<ArchiveStreambuf *>(self);
+		auto b = static_cast<const char *>(buffer);
+		asb->m_buffer.insert(asb->m_buffer.end(), b, b + length);
+		return length;
 	}
 
-	static la_ssize_t write_cb(struct archive *a, void *self, const void *buffer, size_t length)
+	ArchiveFormat m_format;
+	struct archive *m_a;
+	std::vector<std::tuple<std::filesystem::path, std::filesystem::path>> m_entries;
+	std::size_t m_next = 0;
+	std::unique_ptr<std::istream> m_in;
+	std::vector<char> m_buffer;
+	bool m_done = false;
+
+	static inline int s_zstd_level = 3, s_zstd_threads = 0;
+};
+
+class ArchiveStream : public std::istream
+{
+  public:
+	ArchiveStream(ArchiveFormat format = ArchiveFormat::ZIP)
+		: std::istream(nullptr)
+		, m_buf(format)
 	{
-		return static_cast<ZipWriter *>(self)->write(static_cast<const char *>(buffer), length);
+		rdbuf(&m_buf);
 	}
 
-	static int close_cb(struct archive *a, void *self)
+	void add(std::filesystem::path file, std::filesystem::path name)
 	{
-		return ARCHIVE_OK;
+		m_buf.add(std::move(file), std::move(name));
 	}
 
-	la_ssize_t write(const char *buffer, size_t length)
+	bool empty() const
 	{
-		m_s->write(buffer, length);
-		return length;
+		return m_buf.empty();
 	}
 
-	struct archive *m_a;
-	std::unique_ptr<std::stringstream> m_s;
+  private:
+	ArchiveStreambuf m_buf;
 };
 
 // --------------------------------------------------------------------
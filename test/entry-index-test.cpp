@@ -0,0 +1,246 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Tests for the entry index: writing and reading the index file, the
+// filter expressions, sorting and the incremental rebuild.
+
+#include "entry-index.hpp"
+#include "test-support.hpp"
+
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+using zeep::json::element;
+
+// Write the data.json of an entry in a databank laid out as xy/1xyz
+void writeEntry(const fs::path &dataDir, const std::string &id, element properties)
+{
+	auto dir = dataDir / id.substr(1, 2) / id;
+	fs::create_directories(dir);
+
+	element data{ { "properties", std::move(properties) } };
+
+	std::ofstream file(dir / "data.json");
+	file << data;
+}
+
+// The properties of the test databank. A is missing in 1abd, RFREE in
+// 2xyz and GOT_PROT and SPACE in 3def.
+void writeDatabank(const fs::path &dataDir)
+{
+	writeEntry(dataDir, "1abc", { { "RFREE", 0.25 }, { "GOT_PROT", true }, { "SPACE", "P 21" }, { "A", true }, { "B", false }, { "C", true } });
+	writeEntry(dataDir, "1abd", { { "RFREE", 0.20 }, { "GOT_PROT", false }, { "SPACE", "C 2" }, { "B", true }, { "C", true } });
+	writeEntry(dataDir, "2xyz", { { "GOT_PROT", true }, { "SPACE", "P 21" }, { "A", false }, { "B", true }, { "C", false } });
+	writeEntry(dataDir, "3def", { { "RFREE", 0.30 }, { "A", false }, { "B", false }, { "C", true } });
+}
+
+// The pdb-ids of the entries returned for filter, sorted on sort
+std::string select(EntryIndex &index, const std::string &filter, const std::string &sort = {})
+{
+	EntryQuery query;
+	query.filter = filter;
+	query.sort = sort;
+
+	auto r = index.query(query);
+
+	std::string result;
+	for (auto &entry : r["entries"])
+	{
+		if (not result.empty())
+			result += ',';
+		result += entry["pdb-id"].as<std::string>();
+	}
+
+	return result;
+}
+
+void testRoundTrip()
+{
+	TempDir tmp;
+	writeDatabank(tmp.path() / "db");
+
+	EntryIndex index(tmp.path() / "db", tmp.path() / "entry-index.bin");
+	CHECK_EQUAL(index.build(), 4U);
+
+	auto file = index.getFile();
+	CHECK_EQUAL(file->size(), 4U);
+
+	auto rfree = file->getColumn("RFREE");
+	auto gotProt = file->getColumn("GOT_PROT");
+	auto space = file->getColumn("SPACE");
+
+	CHECK(rfree != nullptr and rfree->type == EntryColumnType::NUMBER);
+	CHECK(gotProt != nullptr and gotProt->type == EntryColumnType::BOOLEAN);
+	CHECK(space != nullptr and space->type == EntryColumnType::STRING);
+	CHECK(file->getColumn("FOO") == nullptr);
+
+	if (rfree == nullptr or gotProt == nullptr or space == nullptr)
+		return;
+
+	auto row = file->find("1abc");
+	CHECK_EQUAL(file->getID(row), "1abc");
+	CHECK_EQUAL(rfree->number(row), 0.25);
+	CHECK(gotProt->value(row).is_boolean() and gotProt->value(row).as<bool>());
+	CHECK_EQUAL(std::string(space->string(row)), "P 21");
+
+	row = file->find("1abd");
+	CHECK(gotProt->value(row).is_boolean() and not gotProt->value(row).as<bool>());
+
+	// missing values
+	row = file->find("2xyz");
+	CHECK(rfree->isNull(row));
+	CHECK(rfree->value(row).is_null());
+
+	row = file->find("3def");
+	CHECK(gotProt->isNull(row));
+	CHECK(space->isNull(row));
+	CHECK(space->value(row).is_null());
+
+	CHECK_EQUAL(file->find("9zzz"), file->size());
+}
+
+void testFilter()
+{
+	TempDir tmp;
+	writeDatabank(tmp.path() / "db");
+
+	EntryIndex index(tmp.path() / "db", tmp.path() / "entry-index.bin");
+	index.build();
+
+	// and binds stronger than or, not stronger than and
+	CHECK_EQUAL(select(index, "A or B and not C"), "1abc,2xyz");
+	CHECK_EQUAL(select(index, "(A or B) and not C"), "2xyz");
+
+	// and the usual arithmetic precedence
+	CHECK_EQUAL(select(index, "RFREE - 0.05 * 2 > 0.17"), "3def");
+	CHECK_EQUAL(select(index, "(RFREE - 0.05) * 2 > 0.45"), "3def");
+
+	// missing values are never selected
+	CHECK_EQUAL(select(index, "RFREE > 0 or RFREE <= 0"), "1abc,1abd,3def");
+	CHECK_EQUAL(select(index, "SPACE = 'P 21'"), "1abc,2xyz");
+	CHECK_EQUAL(select(index, "GOT_PROT = false"), "1abd");
+
+	CHECK_THROWS(select(index, "SPACE = 'P 21"), std::runtime_error, "unterminated string");
+	CHECK_THROWS(select(index, "FOO > 1"), std::runtime_error, "unknown column FOO");
+	CHECK_THROWS(select(index, "RFREE >"), std::runtime_error, "unexpected");
+	CHECK_THROWS(select(index, "(RFREE > 0"), std::runtime_error, "expected )");
+
+	// deep nesting is refused before it can overflow the stack
+	CHECK_EQUAL(select(index, std::string(20, '(') + "RFREE > 0.27" + std::string(20, ')')), "3def");
+	CHECK_THROWS(select(index, std::string(5000, '(') + "RFREE" + std::string(5000, ')')), std::runtime_error, "nested too deeply");
+	CHECK_THROWS(select(index, std::string(5000, '-') + "RFREE > 0"), std::runtime_error, "nested too deeply");
+
+	std::string chain = "RFREE";
+	for (int i = 0; i < 2000; ++i)
+		chain += " + 1";
+	CHECK_THROWS(select(index, chain + " > 0"), std::runtime_error, "too many operators");
+	CHECK_THROWS(select(index, "", "FOO"), std::runtime_error, "Unknown sort column FOO");
+
+	EntryQuery query;
+	query.fields = { "RFREE", "FOO" };
+	CHECK_THROWS(index.query(query), std::runtime_error, "Unknown column FOO");
+}
+
+void testSort()
+{
+	TempDir tmp;
+	writeDatabank(tmp.path() / "db");
+
+	EntryIndex index(tmp.path() / "db", tmp.path() / "entry-index.bin");
+	index.build();
+
+	// missing values go last in both directions
+	CHECK_EQUAL(select(index, "", "RFREE"), "1abd,1abc,3def,2xyz");
+	CHECK_EQUAL(select(index, "", "-RFREE"), "3def,1abc,1abd,2xyz");
+
+	// ties keep the pdb-id order
+	CHECK_EQUAL(select(index, "", "SPACE"), "1abd,1abc,2xyz,3def");
+	CHECK_EQUAL(select(index, "", "-SPACE"), "1abc,2xyz,1abd,3def");
+
+	// sorting applies before offset and limit
+	EntryQuery query;
+	query.sort = "RFREE";
+	query.offset = 1;
+	query.limit = 2;
+
+	auto r = index.query(query);
+	CHECK_EQUAL(r["total"].as<int>(), 4);
+	CHECK_EQUAL(r["entries"].size(), 2U);
+	CHECK_EQUAL(r["entries"][0]["pdb-id"].as<std::string>(), "1abc");
+	CHECK_EQUAL(r["entries"][1]["pdb-id"].as<std::string>(), "3def");
+}
+
+void testIncrementalBuild()
+{
+	TempDir tmp;
+	auto dataDir = tmp.path() / "db";
+	writeDatabank(dataDir);
+
+	EntryIndex index(dataDir, tmp.path() / "entry-index.bin");
+	CHECK_EQUAL(index.build(), 4U);
+
+	// nothing changed, nothing is read and the file is kept
+	CHECK_EQUAL(index.build(), 0U);
+
+	// only the changed entry is read again, the others are copied
+	auto file = dataDir / "xy" / "2xyz" / "data.json";
+	writeEntry(dataDir, "2xyz", { { "RFREE", 0.22 }, { "GOT_PROT", true }, { "SPACE", "P 21" } });
+	fs::last_write_time(file, fs::last_write_time(file) + std::chrono::seconds(10));
+
+	CHECK_EQUAL(index.build(), 1U);
+	CHECK_EQUAL(select(index, "", "RFREE"), "1abd,2xyz,1abc,3def");
+	CHECK_EQUAL(select(index, "A"), "1abc");
+	CHECK_EQUAL(select(index, "SPACE = 'C 2'"), "1abd");
+
+	// a removed entry is dropped without reading the others
+	fs::remove_all(dataDir / "de");
+
+	CHECK_EQUAL(index.build(), 0U);
+	CHECK_EQUAL(select(index, "", "RFREE"), "1abd,2xyz,1abc");
+}
+
+void testUnavailable()
+{
+	TempDir tmp;
+
+	EntryIndex index(tmp.path() / "db", tmp.path() / "entry-index.bin");
+	CHECK_THROWS(index.query({}), EntryIndexUnavailable, "not available");
+}
+
+int main()
+{
+	testRoundTrip();
+	testFilter();
+	testSort();
+	testIncrementalBuild();
+	testUnavailable();
+
+	if (testFailures() == 0)
+		std::cout << "All tests passed" << std::endl;
+
+	return testFailures();
+}
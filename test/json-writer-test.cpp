@@ -0,0 +1,234 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Tests for JsonWriter: the text written by toJSON, parsed again, must be
+// the same as the result of to_element for the objects the API returns.
+
+#include "api-controller.hpp"
+#include "json-writer.hpp"
+#include "run-service.hpp"
+#include "test-support.hpp"
+
+#include <zeep/json/parser.hpp>
+
+using zeep::json::element;
+
+// Compare a and b, reporting the differences along with the path to them.
+// An object member that is null is the same as a missing one, to_element
+// may leave out members without value where toJSON writes null.
+void compare(const element &a, const element &b, const std::string &path = "$")
+{
+	if (a.is_number() and b.is_number())
+	{
+		if (a.as<double>() != b.as<double>())
+		{
+			std::cerr << path << ": " << a << " != " << b << '\n';
+			++testFailures();
+		}
+	}
+	else if (a.is_object() and b.is_object())
+	{
+		for (auto p = a.begin(); p != a.end(); ++p)
+		{
+			auto q = b.find(p.key());
+			if (q != b.end())
+				compare(p.value(), q.value(), path + '.' + p.key());
+			else if (not p.value().is_null())
+			{
+				std::cerr << path << '.' << p.key() << ": missing in toJSON result\n";
+				++testFailures();
+			}
+		}
+
+		for (auto q = b.begin(); q != b.end(); ++q)
+		{
+			if (a.find(q.key()) == a.end() and not q.value().is_null())
+			{
+				std::cerr << path << '.' << q.key() << ": missing in to_element result\n";
+				++testFailures();
+			}
+		}
+	}
+	else if (a.is_array() and b.is_array())
+	{
+		if (a.size() != b.size())
+		{
+			std::cerr << path << ": arrays differ in size\n";
+			++testFailures();
+			return;
+		}
+
+		auto p = a.begin();
+		auto q = b.begin();
+		for (std::size_t i = 0; p != a.end(); ++i, ++p, ++q)
+			compare(*p, *q, path + '[' + std::to_string(i) + ']');
+	}
+	else if (not(a == b))
+	{
+		std::cerr << path << ": " << a << " != " << b << '\n';
+		++testFailures();
+	}
+}
+
+// Check that toJSON(v) reads back as to_element(v) and return the former
+template <typename T>
+element check(const T &v)
+{
+	element expected;
+	to_element(expected, v);
+
+	element result;
+	zeep::json::parse_json(toJSON(v), result);
+
+	compare(expected, result);
+
+	return result;
+}
+
+// --------------------------------------------------------------------
+
+// A run with all of the optional parts of a score filled in, except for
+// the nucleic acid geometry. Estimates are left empty as for ended runs.
+Run createRun()
+{
+	using namespace std::chrono_literals;
+
+	Run run{};
+
+	run.id = 42;
+	run.user = "tester";
+	run.status = RunStatus::ENDED;
+	run.has_image = true;
+	run.date = std::chrono::system_clock::time_point{ 1700000000s };
+	run.started = run.date + 5min;
+	run.running = run.date + 7min;
+	run.ended = run.date + 2h;
+	run.input = { "1abc.cif", "with \"quotes\"\tand\\slash.mtz" };
+	run.size = 123456789012;
+
+	Score score{};
+	score.ddatafit = { -1.25, -10, 10, 2 };
+	score.proteinGeometry = ProteinGeometry{ 0.75, -1.5, 3.5, 4 };
+
+	StatsPercentiles percentiles;
+	percentiles.RFREE = 37.5;
+	percentiles.RFFIN = 1.0 / 3;
+	percentiles.OCHI12 = 100;
+	score.percentiles = percentiles;
+
+	EntryClasses classes;
+	classes.RFFIN = "better";
+	classes.RFFIN_PERCENTILE = "worse";
+	classes.TFHBSAT = "better";
+	score.classes = classes;
+
+	run.score = score;
+
+	return run;
+}
+
+void testRun()
+{
+	auto run = createRun();
+	auto result = check(run);
+
+	CHECK_EQUAL(result["status"].as<std::string>(), "ended");
+	CHECK(result["running-date"].is_string());
+	CHECK(result["score"]["basePairs"].is_null());
+	CHECK(result["score"]["percentiles"]["OZRAMA"].is_null());
+	CHECK(result["rank"].is_null());
+	CHECK(result["estimated-start"].is_null());
+
+	// a queued run without score and dates
+	run.status = RunStatus::QUEUED;
+	run.has_image = false;
+	run.score.reset();
+	run.started.reset();
+	run.running.reset();
+	run.ended.reset();
+	run.rank = 3;
+	run.estimatedStart = run.date + 1h;
+	run.estimatedEnd = run.date + 3h;
+	run.input.clear();
+
+	result = check(run);
+
+	CHECK_EQUAL(result["status"].as<std::string>(), "queued");
+	CHECK(result["score"].is_null());
+	CHECK(result["ended-date"].is_null());
+	CHECK(result["input"].is_array());
+	CHECK_EQUAL(result["rank"].as<int>(), 3);
+}
+
+void testJobInfo()
+{
+	auto run = createRun();
+
+	auto result = check(JobInfo(run));
+	CHECK_EQUAL(result["id"].as<int>(), 42);
+	CHECK(result["score"]["classes"].is_object());
+
+	run.status = RunStatus::RUNNING;
+	run.score.reset();
+	run.ended.reset();
+
+	// The list of runs is written as a whole
+	std::vector<JobInfo> jobs{ JobInfo(createRun()), JobInfo(run) };
+	result = check(jobs);
+
+	CHECK_EQUAL(result.size(), 2U);
+	check(std::vector<JobInfo>{});
+}
+
+void testDiskUsage()
+{
+	check(DiskUsage{ "tester", 12, 34567890123 });
+	check(DiskUsage{});
+	check(std::vector<DiskUsage>{ { "a", 1, 2 }, { "b", 0, 0 } });
+}
+
+int main()
+{
+	zeep::value_serializer<RunStatus>::instance("RunStatus")
+		("undefined", RunStatus::UNDEFINED)
+		("registered", RunStatus::REGISTERED)
+		("starting", RunStatus::STARTING)
+		("queued", RunStatus::QUEUED)
+		("running", RunStatus::RUNNING)
+		("stopping", RunStatus::STOPPING)
+		("stopped", RunStatus::STOPPED)
+		("ended", RunStatus::ENDED)
+		("deleting", RunStatus::DELETING);
+
+	testRun();
+	testJobInfo();
+	testDiskUsage();
+
+	if (testFailures() == 0)
+		std::cout << "All tests passed" << std::endl;
+
+	return testFailures();
+}
@@ -0,0 +1,289 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Tests for the binary rama-angles encoding. The encoded sample is decoded
+// here following the layout in rama-angles.hpp. When a file name is passed
+// it is also written there, test/rama-angles-test.mjs then decodes it with
+// the decoder of the webapp.
+
+#include "rama-angles.hpp"
+#include "test-support.hpp"
+
+#include <zeep/json/parser.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+using zeep::json::element;
+
+// Three residues in two chains. The first lacks an orig phi and a rama
+// class, the second is cis and the third has no redo class and psi. The
+// strings add up to 17 bytes, so the string table needs padding. The
+// second model must be skipped.
+const char kSample[] = R"({
+	"rama-angles": [
+		{
+			"chains": [
+				{
+					"asym_id": "A",
+					"models": [
+						{
+							"residues": [
+								{
+									"compound_id": "ALA", "seq_id": 1,
+									"orig": { "phi": null, "psi": 120.5, "cis": false },
+									"redo": { "phi": -60.12, "psi": -45.0, "rama": "Favored", "cis": false }
+								},
+								{
+									"compound_id": "PRO", "seq_id": 2,
+									"orig": { "phi": -70.0, "psi": 150.25, "rama": "OUTLIER", "cis": true },
+									"redo": { "phi": -65.5, "psi": 140.0, "rama": "Allowed", "cis": true }
+								}
+							]
+						},
+						{
+							"residues": [
+								{
+									"compound_id": "TRP", "seq_id": 1,
+									"orig": { "phi": 1.0, "psi": 1.0 },
+									"redo": { "phi": 1.0, "psi": 1.0 }
+								}
+							]
+						}
+					]
+				},
+				{
+					"asym_id": "BB",
+					"models": [
+						{
+							"residues": [
+								{
+									"compound_id": "GLY", "seq_id": "103",
+									"orig": { "phi": 179.99, "psi": -179.99, "rama": "Allowed", "cis": false },
+									"redo": { "phi": -180.0 }
+								}
+							]
+						}
+					]
+				}
+			]
+		}
+	]
+})";
+
+// Reads the values of the encoded data, in order
+class Reader
+{
+  public:
+	Reader(const std::string &data)
+		: m_data(data)
+	{
+	}
+
+	template <typename T>
+	T read()
+	{
+		T result{};
+		if (m_offset + sizeof(T) > m_data.length())
+		{
+			CHECK(not "read past the end of the data");
+			return result;
+		}
+
+		std::memcpy(&result, m_data.data() + m_offset, sizeof(T));
+		m_offset += sizeof(T);
+		return result;
+	}
+
+	template <typename T>
+	std::vector<T> read(std::size_t n)
+	{
+		std::vector<T> result;
+		for (std::size_t i = 0; i < n; ++i)
+			result.push_back(read<T>());
+		return result;
+	}
+
+	std::string readString(std::size_t n)
+	{
+		auto result = m_data.substr(m_offset, n);
+		m_offset += n;
+		return result;
+	}
+
+	std::size_t offset() const { return m_offset; }
+
+  private:
+	const std::string &m_data;
+	std::size_t m_offset = 0;
+};
+
+// --------------------------------------------------------------------
+
+std::string encodeSample()
+{
+	element data;
+	zeep::json::parse_json(kSample, data);
+	return RamaAnglesService::encode(data["rama-angles"]);
+}
+
+void testEncoding()
+{
+	auto data = encodeSample();
+	Reader r(data);
+
+	CHECK_EQUAL(r.readString(4), "RAMA");
+	CHECK_EQUAL(r.read<uint32_t>(), RamaAnglesService::kVersion);
+
+	auto n = r.read<uint32_t>();
+	auto stringCount = r.read<uint32_t>();
+	auto stringSize = r.read<uint32_t>();
+
+	CHECK_EQUAL(n, 3U);
+	CHECK_EQUAL(stringCount, 8U);
+	CHECK_EQUAL(stringSize, 17U);
+
+	auto offsets = r.read<uint32_t>(stringCount + 1);
+	CHECK_EQUAL(offsets.back(), stringSize);
+
+	auto stringData = r.readString(stringSize);
+	CHECK_EQUAL(stringData, "AALA1PRO2BBGLY103");
+
+	// three zero bytes of padding, the columns start four byte aligned
+	CHECK_EQUAL(r.readString(3), std::string(3, '\0'));
+	CHECK_EQUAL(r.offset() % 4, 0U);
+
+	std::vector<std::string> strings;
+	for (std::size_t i = 0; i < stringCount; ++i)
+		strings.push_back(stringData.substr(offsets[i], offsets[i + 1] - offsets[i]));
+
+	auto chain = r.read<uint32_t>(n);
+	auto compound = r.read<uint32_t>(n);
+	auto number = r.read<uint32_t>(n);
+
+	CHECK_EQUAL(strings[chain[0]], "A");
+	CHECK_EQUAL(strings[chain[1]], "A");
+	CHECK_EQUAL(strings[chain[2]], "BB");
+	CHECK_EQUAL(strings[compound[1]], "PRO");
+	CHECK_EQUAL(strings[compound[2]], "GLY");
+	CHECK_EQUAL(strings[number[0]], "1");
+	CHECK_EQUAL(strings[number[2]], "103");
+
+	auto origPhi = r.read<int16_t>(n);
+	auto origPsi = r.read<int16_t>(n);
+	auto redoPhi = r.read<int16_t>(n);
+	auto redoPsi = r.read<int16_t>(n);
+
+	CHECK_EQUAL(origPhi[0], RamaAnglesService::kMissingAngle);
+	CHECK_EQUAL(origPsi[0], 12050);
+	CHECK_EQUAL(redoPhi[0], -6012);
+	CHECK_EQUAL(origPhi[1], -7000);
+	CHECK_EQUAL(origPsi[1], 15025);
+	CHECK_EQUAL(origPhi[2], 17999);
+	CHECK_EQUAL(origPsi[2], -17999);
+	CHECK_EQUAL(redoPhi[2], -18000);
+	CHECK_EQUAL(redoPsi[2], RamaAnglesService::kMissingAngle);
+
+	// rama class in the lower two bits, cis in bit 2
+	auto origFlags = r.read<uint8_t>(n);
+	auto redoFlags = r.read<uint8_t>(n);
+
+	CHECK_EQUAL(int(origFlags[0]), 0);
+	CHECK_EQUAL(int(redoFlags[0]), 1);
+	CHECK_EQUAL(int(origFlags[1]), 3 | 4);
+	CHECK_EQUAL(int(redoFlags[1]), 2 | 4);
+	CHECK_EQUAL(int(origFlags[2]), 2);
+	CHECK_EQUAL(int(redoFlags[2]), 0);
+
+	CHECK_EQUAL(r.offset(), data.length());
+}
+
+// update stores the encoded file in the cache directory, get serves it
+// from there. The directory of data.json is left alone.
+void testStore()
+{
+	TempDir tmp;
+
+	auto entryDir = tmp.path() / "entry";
+	fs::create_directories(entryDir);
+
+	auto dataJson = entryDir / "data.json";
+	std::ofstream(dataJson) << kSample;
+
+	element data;
+	zeep::json::parse_json(kSample, data);
+
+	RamaAnglesService service(tmp.path() / "cache");
+
+	auto key = RamaAnglesService::entryKey("1abc");
+	auto file = service.getFile(key);
+	CHECK_EQUAL(file, tmp.path() / "cache" / "db" / "ab" / "1abc.bin");
+
+	service.update(key, dataJson, data);
+	CHECK(fs::exists(file));
+	CHECK_EQUAL(std::distance(fs::directory_iterator(entryDir), fs::directory_iterator()), 1);
+
+	std::ifstream in(file, std::ios::binary);
+	std::ostringstream s;
+	s << in.rdbuf();
+	CHECK(s.str() == encodeSample());
+
+	// a stored file from another version is replaced
+	std::ofstream(file, std::ios::binary | std::ios::trunc) << "RAMA\x07";
+
+	auto angles = service.get(key, dataJson);
+	CHECK(angles->data == encodeSample());
+	CHECK(fs::file_size(file) == angles->data.length());
+	CHECK(not angles->etag.empty());
+
+	// no temporary files are left behind
+	CHECK_EQUAL(std::distance(fs::directory_iterator(file.parent_path()), fs::directory_iterator()), 1);
+
+	service.remove(key);
+	CHECK(not fs::exists(file));
+}
+
+int main(int argc, char *const argv[])
+{
+	testEncoding();
+	testStore();
+
+	if (argc == 2)
+	{
+		auto data = encodeSample();
+		std::ofstream out(argv[1], std::ios::binary);
+		out.write(data.data(), data.length());
+	}
+
+	if (testFailures() == 0)
+		std::cout << "All tests passed" << std::endl;
+
+	return testFailures();
+}
@@ -0,0 +1,29 @@
+// Decodes the rama-angles written by rama-angles-test with the decoder of
+// the webapp and checks the result against the sample in that test.
+
+import { decodeRamaAngles } from '../webapp/rama-angles.js';
+import { readFileSync } from 'fs';
+import { deepStrictEqual } from 'assert';
+
+const file = readFileSync(process.argv[2]);
+const residues = decodeRamaAngles(file.buffer.slice(file.byteOffset, file.byteOffset + file.length));
+
+deepStrictEqual(residues, [
+	{
+		chain: 'A', compound_id: 'ALA', seq_id: '1',
+		orig: { phi: null, psi: 120.5, rama: undefined, cis: false },
+		redo: { phi: -60.12, psi: -45, rama: 'Favored', cis: false }
+	},
+	{
+		chain: 'A', compound_id: 'PRO', seq_id: '2',
+		orig: { phi: -70, psi: 150.25, rama: 'OUTLIER', cis: true },
+		redo: { phi: -65.5, psi: 140, rama: 'Allowed', cis: true }
+	},
+	{
+		chain: 'BB', compound_id: 'GLY', seq_id: '103',
+		orig: { phi: 179.99, psi: -179.99, rama: 'Allowed', cis: false },
+		redo: { phi: -180, psi: null, rama: undefined, cis: false }
+	}
+]);
+
+console.log('All tests passed');
@@ -0,0 +1,93 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Tests for the retention policy. The rules end up in SQL, these tests
+// check what the generated query selects.
+
+#include "run-service.hpp"
+#include "test-support.hpp"
+
+void testDisabled()
+{
+	RetentionPolicy policy;
+	CHECK(not policy.enabled());
+	CHECK(policy.query().empty());
+
+	// the batch size and dry run do not make a rule
+	policy.batchSize = 1;
+	policy.dryRun = true;
+	CHECK(policy.query().empty());
+}
+
+// A user may keep exactly maxRunsPerUser finished runs, the run after
+// that is the first to go. Only finished runs are numbered, so active
+// and waiting runs of the user do not push finished runs over the limit.
+void testQuota()
+{
+	RetentionPolicy policy;
+	policy.maxRunsPerUser = 3;
+
+	auto query = policy.query();
+	CHECK(policy.enabled());
+	CHECK(query.find(" WHEN r.nr > 3 THEN 'quota'") != std::string::npos);
+	CHECK(query.find("r.nr >= ") == std::string::npos);
+	CHECK(query.find("'age'") == std::string::npos);
+
+	// the numbering is over the finished runs of a user only
+	auto numbering = query.find("row_number() OVER (PARTITION BY user_id ORDER BY created DESC, id DESC) AS nr");
+	auto finished = query.find("FROM redo.run WHERE status IN ('ended', 'stopped')) r");
+	CHECK(numbering != std::string::npos);
+	CHECK(finished != std::string::npos);
+	CHECK(numbering < finished);
+	CHECK(query.find("r.status IN") == std::string::npos);
+
+	policy.maxRunsPerUser = 1;
+	CHECK(policy.query().find(" WHEN r.nr > 1 THEN 'quota'") != std::string::npos);
+}
+
+void testAge()
+{
+	RetentionPolicy policy;
+	policy.days = 30;
+	policy.stoppedDays = 7;
+
+	auto query = policy.query();
+	CHECK(query.find("r.status = 'ended' AND coalesce(r.ended, r.created) < CURRENT_TIMESTAMP - make_interval(days => 30) THEN 'age'") != std::string::npos);
+	CHECK(query.find("r.status = 'stopped' AND coalesce(r.ended, r.created) < CURRENT_TIMESTAMP - make_interval(days => 7) THEN 'age'") != std::string::npos);
+	CHECK(query.find("'quota'") == std::string::npos);
+}
+
+int main()
+{
+	testDisabled();
+	testQuota();
+	testAge();
+
+	if (testFailures() == 0)
+		std::cout << "All tests passed" << std::endl;
+
+	return testFailures();
+}
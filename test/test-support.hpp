@@ -0,0 +1,110 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// A minimal test driver: the CHECK macros report failures and count them,
+// a test program returns the number of failures from main.
+
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+
+inline int &testFailures()
+{
+	static int s_failures = 0;
+	return s_failures;
+}
+
+#define CHECK(expr)                                                                 \
+	do                                                                              \
+	{                                                                               \
+		if (not(expr))                                                              \
+		{                                                                           \
+			std::cerr << __FILE__ << ':' << __LINE__ << ": check failed: " #expr "\n"; \
+			++testFailures();                                                       \
+		}                                                                           \
+	} while (false)
+
+#define CHECK_EQUAL(a, b)                                                                      \
+	do                                                                                         \
+	{                                                                                          \
+		auto &&va_ = (a);                                                                      \
+		auto &&vb_ = (b);                                                                      \
+		if (not(va_ == vb_))                                                                   \
+		{                                                                                      \
+			std::cerr << __FILE__ << ':' << __LINE__ << ": check failed: " #a " == " #b " ("    \
+					  << va_ << " != " << vb_ << ")\n";                                        \
+			++testFailures();                                                                  \
+		}                                                                                      \
+	} while (false)
+
+// Check that expr throws an exception of type E with msg in its what()
+#define CHECK_THROWS(expr, E, msg)                                                                    \
+	do                                                                                                \
+	{                                                                                                 \
+		try                                                                                           \
+		{                                                                                             \
+			expr;                                                                                     \
+			std::cerr << __FILE__ << ':' << __LINE__ << ": no exception thrown by " #expr "\n";       \
+			++testFailures();                                                                         \
+		}                                                                                             \
+		catch (const E &ex_)                                                                          \
+		{                                                                                             \
+			if (std::string(ex_.what()).find(msg) == std::string::npos)                               \
+			{                                                                                         \
+				std::cerr << __FILE__ << ':' << __LINE__ << ": unexpected message: " << ex_.what() << '\n'; \
+				++testFailures();                                                                     \
+			}                                                                                         \
+		}                                                                                             \
+	} while (false)
+
+// A scratch directory, removed again at the end of the test
+class TempDir
+{
+  public:
+	TempDir()
+	{
+		std::random_device rng;
+		m_path = std::filesystem::temp_directory_path() / ("prsmd-test-" + std::to_string(rng()));
+		std::filesystem::create_directories(m_path);
+	}
+
+	~TempDir()
+	{
+		std::error_code ec;
+		std::filesystem::remove_all(m_path, ec);
+	}
+
+	TempDir(const TempDir &) = delete;
+	TempDir &operator=(const TempDir &) = delete;
+
+	const std::filesystem::path &path() const { return m_path; }
+
+  private:
+	std::filesystem::path m_path;
+};
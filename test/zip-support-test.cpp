@@ -0,0 +1,87 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 NKI/AVL, Netherlands Cancer Institute
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Tests for the selection of files for archives
+
+#include "test-support.hpp"
+#include "zip-support.hpp"
+
+using Patterns = std::optional<std::string>;
+
+void testSelection()
+{
+	FileSelection all;
+	CHECK(all.empty());
+	CHECK(all("output/1abc_final.cif"));
+
+	// include patterns match file names and directory names
+	FileSelection cif(Patterns("*.cif"), {});
+	CHECK(cif("output/1abc_final.cif"));
+	CHECK(not cif("output/1abc_final.mtz"));
+
+	FileSelection dir(Patterns("output"), {});
+	CHECK(dir("output/1abc_final.mtz"));
+	CHECK(not dir("input/PDB/1abc.cif"));
+
+	// a pattern with a slash is matched against the whole path
+	FileSelection path(Patterns("output/*.mtz"), {});
+	CHECK(path("output/1abc_final.mtz"));
+	CHECK(not path("input/MTZ/1abc.mtz"));
+
+	// exclude wins
+	FileSelection both(Patterns("*.cif"), Patterns("*_0cyc*"));
+	CHECK(both("output/1abc_final.cif"));
+	CHECK(not both("output/1abc_0cyc.cif"));
+}
+
+void testSelectionWhiteSpace()
+{
+	// white space around patterns is ignored, empty patterns are dropped
+	FileSelection include(Patterns("*.cif, *.mtz ,\t*.log"), {});
+	CHECK(include("output/1abc_final.cif"));
+	CHECK(include("output/1abc_final.mtz"));
+	CHECK(include("process.log"));
+	CHECK(not include("output/1abc_final.pdb"));
+
+	FileSelection exclude({}, Patterns(" *.mtz , "));
+	CHECK(exclude("output/1abc_final.cif"));
+	CHECK(not exclude("output/1abc_final.mtz"));
+
+	FileSelection empty(Patterns(" , ,"), Patterns(""));
+	CHECK(empty.empty());
+	CHECK(empty("output/1abc_final.cif"));
+}
+
+int main()
+{
+	testSelection();
+	testSelectionWhiteSpace();
+
+	if (testFailures() == 0)
+		std::cout << "All tests passed" << std::endl;
+
+	return testFailures();
+}
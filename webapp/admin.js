@@ -34,8 +34,12 @@ class SortableTable {
 		this.sortDescending = desc;
 
 		rowArray.sort((a, b) => {
-			let ka = Array.from(a.children)[ix].innerText;
-			let kb = Array.from(b.children)[ix].innerText;
+			const ca = Array.from(a.children)[ix];
+			const cb = Array.from(b.children)[ix];
+
+			// formatted values, like disk sizes, carry their raw value
+			let ka = ca.dataset.sortValue ?? ca.innerText;
+			let kb = cb.dataset.sortValue ?? cb.innerText;
 
 			let d = 0;
 
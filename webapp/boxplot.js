@@ -1,41 +1,25 @@
 import * as d3 from 'd3';
 
+// The box plot summary as calculated by the server, values are multiplied by scale
 class Data {
-	constructor(x, values, score, colour, sigma) {
-		values.sort((a, b) => a - b);
-
+	constructor(x, summary, count, scale, score, colour, sigma) {
 		this.x = x;
-		this.values = values;
 		this.score = score;
 		this.colour = colour;
 		this.sigma = sigma;
+		this.count = count;
 
-		const [min, max] = values.map(d => [d, d])
-			.reduce((a, b) =>
-				[
-					Math.min(a[0], b[0]),
-					Math.max(a[1], b[1])
-				]);
-
-		this.min = min;
-		this.max = max;
-
-		this.quartiles = [
-			d3.quantile(values, 0.25),
-			d3.quantile(values, 0.50),
-			d3.quantile(values, 0.75)
-		];
+		this.min = summary.min * scale;
+		this.max = summary.max * scale;
+		this.quartiles = summary.quartiles.map(v => v * scale);
+		this.whiskers = summary.whiskers.map(v => v * scale);
+		this.values = summary.outliers.map(v => v * scale);
 
 		const iqr = this.quartiles[2] - this.quartiles[0];
 
-		this.whiskers = [
-			Math.max(min, this.quartiles[0] - iqr * 1.5),
-			Math.min(max, this.quartiles[2] + iqr * 1.5)
-		];
-
 		this.range = [
-			Math.min(score, Math.max(min, this.quartiles[0] - iqr * 3)),
-			Math.max(score, Math.min(max, this.quartiles[2] + iqr * 3))
+			Math.min(score, Math.max(this.min, this.quartiles[0] - iqr * 3)),
+			Math.max(score, Math.min(this.max, this.quartiles[2] + iqr * 3))
 		];
 	}
 
@@ -45,7 +29,7 @@ class Data {
 	}
 
 	length() {
-		return this.values.length;
+		return this.count;
 	}
 }
 
@@ -225,8 +209,8 @@ function BoxPlot(width, height, title, yLabel, data, range) {
 function createBoxPlots(e, s, td) {
 
 	const dataRFree = [
-		new Data('Original', s.map(d => 100 * d.RFREE), 100 * e.RFREE, 'blue', 100 * e.SIGRFCAL),
-		new Data('PDB-REDO', s.map(d => 100 * d.RFFIN), 100 * e.RFFIN, 'orange', 100 * e.SIGRFFIN)
+		new Data('Original', s.RFREE, s.count, 100, 100 * e.RFREE, 'blue', 100 * e.SIGRFCAL),
+		new Data('PDB-REDO', s.RFFIN, s.count, 100, 100 * e.RFFIN, 'orange', 100 * e.SIGRFFIN)
 	];
 	const range = dataRFree.map(d => d.range)
 		.reduce((a, b) => [Math.min(a[0], b[0]), Math.max(a[1], b[1])]);
@@ -236,13 +220,13 @@ function createBoxPlots(e, s, td) {
 
 	if (e.OZRAMA != null && e.FZRAMA != null && e.FCHI12 != null && e.OSCHI12 != null) {
 		const dataRama = [
-			new Data('Original', s.map(d => d.OZRAMA), e.OZRAMA, 'blue', e.OSZRAMA),
-			new Data('PDB-REDO', s.map(d => d.FZRAMA), e.FZRAMA, 'orange', e.FSZRAMA)
+			new Data('Original', s.OZRAMA, s.count, 1, e.OZRAMA, 'blue', e.OSZRAMA),
+			new Data('PDB-REDO', s.FZRAMA, s.count, 1, e.FZRAMA, 'orange', e.FSZRAMA)
 		];
 
 		const dataRota = [
-			new Data('Original', s.map(d => d.OCHI12), e.OCHI12, 'blue', e.OSCHI12),
-			new Data('PDB-REDO', s.map(d => d.FCHI12), e.FCHI12, 'orange', e.FSCHI12)
+			new Data('Original', s.OCHI12, s.count, 1, e.OCHI12, 'blue', e.OSCHI12),
+			new Data('PDB-REDO', s.FCHI12, s.count, 1, e.FCHI12, 'orange', e.FSCHI12)
 		];
 
 		const rRange = [...dataRama, ...dataRota].map(d => d.range)
@@ -258,7 +242,7 @@ function createBoxPlots(e, s, td) {
 
 export function createBoxPlot(data, td, url) {
 	const ureso = data.URESO;
-	fetch(`${url}/gfx/statistics-for-box-plot?ureso=${ureso}`)
+	fetch(`${url}/gfx/statistics-for-box-plot?ureso=${ureso}&summary=true`)
 		.then(r => r.json())
 		.then(s => createBoxPlots(data, s, td))
 		.catch(e => console.log(e));
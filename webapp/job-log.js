@@ -0,0 +1,43 @@
+// Follow the log of a job that has not finished yet. The log is polled,
+// the server does not keep the request open.
+
+const kPollInterval = 5000;
+
+function sleep(ms) {
+	return new Promise(resolve => setTimeout(resolve, ms));
+}
+
+async function followLog(pre) {
+	let offset = pre.dataset.offset;
+
+	for (;;) {
+		const r = await fetch(`${pre.dataset.url}?offset=${offset}`, { credentials: 'include' });
+		if (!r.ok)
+			throw `Could not fetch log: ${r.status}`;
+
+		const log = await r.json();
+
+		if (log.offset < offset)	// the log was restarted
+			pre.textContent = '';
+
+		pre.textContent += log.text;
+		offset = log.offset;
+
+		if (log.finished) {
+			// the result page replaces this page when the job ended successfully
+			if (log.status === 'ended')
+				window.location.reload();
+			break;
+		}
+
+		// a long log is read in several chunks, only wait when nothing was new
+		if (log.text.length === 0)
+			await sleep(kPollInterval);
+	}
+}
+
+window.addEventListener('load', () => {
+	const pre = document.getElementById('job-log');
+	if (pre && pre.dataset.url && pre.dataset.status !== 'stopped' && pre.dataset.status !== 'ended')
+		followLog(pre).catch(err => console.log(err));
+});
@@ -45,6 +45,38 @@ window.addEventListener('load', () => {
 				});
 			});
 
+		const checkBoxes = [...table.querySelectorAll('input.select-cb')];
+		const downloadBtn = document.querySelector('#download-selected-btn');
+		const selectAll = document.querySelector('#select-all-cb');
+
+		const selected = () => checkBoxes.filter(cb => cb.checked).map(cb => cb.dataset.id);
+		const updateDownloadBtn = () => downloadBtn.disabled = selected().length == 0;
+
+		checkBoxes.forEach(cb => {
+			cb.disabled = cb.closest('tr').dataset.status != 'ended';
+			cb.addEventListener('click', (e) => e.stopPropagation());
+			cb.addEventListener('change', updateDownloadBtn);
+		});
+
+		if (selectAll) {
+			selectAll.addEventListener('change', () => {
+				checkBoxes.filter(cb => !cb.disabled).forEach(cb => cb.checked = selectAll.checked);
+				updateDownloadBtn();
+			});
+		}
+
+		// POST the selection, a long list of IDs does not fit in a URL
+		const downloadForm = document.querySelector('#download-selected-form');
+		if (downloadForm) {
+			downloadForm.addEventListener('submit', (e) => {
+				const ids = selected();
+				if (ids.length == 0)
+					e.preventDefault();
+				else
+					downloadForm.elements['ids'].value = `[${ids.join(",")}]`;
+			});
+		}
+
 		if (jobIDs.length > 0) {
 			const url = encodeURI(`job/status?ids=[${jobIDs.join(",")}]`);
 
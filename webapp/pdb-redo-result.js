@@ -1,5 +1,6 @@
 import { createBoxPlot } from "./boxplot";
 import { RamachandranPlot } from './ramaplot';
+import { decodeRamaAngles } from './rama-angles';
 
 // Extend the LitElement base class
 class PDBRedoResult extends HTMLElement {
@@ -50,6 +51,7 @@ class PDBRedoResult extends HTMLElement {
 		this.include_credentials = this.getAttribute('include-credentials') != null;
 
 		this.pdbID = this.getAttribute('pdb-id');
+		this.attic = this.getAttribute('attic');
 
 		this.tokenID = this.getAttribute('token-id');
 		this.tokenSecret = this.getAttribute('token-secret');
@@ -120,7 +122,11 @@ class PDBRedoResult extends HTMLElement {
 	}
 
 	reloadDBData() {
-		fetch(`${this.pdb_redo_url}/db/entry?pdb-id=${this.pdbID}`, { method: "post" })
+		let url = `${this.pdb_redo_url}/db/entry?pdb-id=${this.pdbID}`;
+		if (this.attic)
+			url += `&attic=${this.attic}`;
+
+		fetch(url)
 			.then(r => {
 				if (r.ok)
 					return r.text();
@@ -197,12 +203,26 @@ class PDBRedoResult extends HTMLElement {
 		}
 
 		const ramaPlot = shadow.querySelector('ramachandran-plot');
-		if (typeof entryData['rama-angles'] === "object" && entryData['rama-angles'] != null)
-			ramaPlot.setData(entryData.data, entryData['rama-angles']);
-		else {
-			const ramaPlotDiv = shadow.querySelector('#rama-plot-div');
-			ramaPlotDiv.classList.add('hide');
+		const hideRamaPlot = () => shadow.querySelector('#rama-plot-div').classList.add('hide');
+
+		if (entryData.link != null && entryData.link.rama_angles != null) {
+			fetch(`${this.pdb_redo_url}${entryData.link.rama_angles}`)
+				.then(r => {
+					if (r.ok)
+						return r.arrayBuffer();
+					else
+						throw `Error fetching rama-angles, status code was ${r.status}`;
+				})
+				.then(buffer => ramaPlot.setResidues(entryData.data, decodeRamaAngles(buffer)))
+				.catch(err => {
+					console.log(err);
+					hideRamaPlot();
+				});
 		}
+		else if (typeof entryData['rama-angles'] === "object" && entryData['rama-angles'] != null)
+			ramaPlot.setData(entryData.data, entryData['rama-angles']);
+		else
+			hideRamaPlot();
 	}
 }
 
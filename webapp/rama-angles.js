@@ -0,0 +1,70 @@
+// Decoder for the compact binary form of the rama-angles, the layout is
+// described in src/rama-angles.hpp
+
+const kVersion = 1;
+const kMissingAngle = -32768;
+const kRamaClass = [undefined, 'Favored', 'Allowed', 'OUTLIER'];
+const kCisFlag = 1 << 2;
+
+// Returns a list of residues, each with chain, compound_id, seq_id, orig and redo
+export function decodeRamaAngles(buffer) {
+	const view = new DataView(buffer);
+
+	const magic = String.fromCharCode(...new Uint8Array(buffer, 0, 4));
+	if (magic !== 'RAMA' || view.getUint32(4, true) !== kVersion)
+		throw 'Unsupported format for rama-angles';
+
+	const n = view.getUint32(8, true);
+	const stringCount = view.getUint32(12, true);
+	const stringSize = view.getUint32(16, true);
+
+	let offset = 20;
+
+	const stringOffsets = new Uint32Array(buffer, offset, stringCount + 1);
+	offset += stringOffsets.byteLength;
+
+	const stringData = new Uint8Array(buffer, offset, stringSize);
+	offset += (stringSize + 3) & ~3;
+
+	const decoder = new TextDecoder();
+	const strings = [];
+	for (let i = 0; i < stringCount; ++i)
+		strings.push(decoder.decode(stringData.subarray(stringOffsets[i], stringOffsets[i + 1])));
+
+	const column = (type) => {
+		const result = new type(buffer, offset, n);
+		offset += result.byteLength;
+		return result;
+	};
+
+	const chain = column(Uint32Array);
+	const compound = column(Uint32Array);
+	const number = column(Uint32Array);
+	const origPhi = column(Int16Array);
+	const origPsi = column(Int16Array);
+	const redoPhi = column(Int16Array);
+	const redoPsi = column(Int16Array);
+	const origFlags = column(Uint8Array);
+	const redoFlags = column(Uint8Array);
+
+	const angle = a => a === kMissingAngle ? null : a / 100;
+	const state = (phi, psi, flags) => ({
+		phi: angle(phi),
+		psi: angle(psi),
+		rama: kRamaClass[flags & 3],
+		cis: (flags & kCisFlag) !== 0
+	});
+
+	const residues = new Array(n);
+	for (let i = 0; i < n; ++i) {
+		residues[i] = {
+			chain: strings[chain[i]],
+			compound_id: strings[compound[i]],
+			seq_id: strings[number[i]],
+			orig: state(origPhi[i], origPsi[i], origFlags[i]),
+			redo: state(redoPhi[i], redoPsi[i], redoFlags[i])
+		};
+	}
+
+	return residues;
+}
@@ -330,9 +330,25 @@ export class RamachandranPlot extends LitElement {
 		this.updateBackground();
 	}
 
-	// routine to create precalculated data array
+	// routine to create precalculated data array from the rama-angles in data.json
 	setData(data, rama) {
 
+		const residues = [];
+
+		rama.forEach(entity => {
+			entity.chains.forEach(chain => {
+				chain.models[0].residues.forEach(residue => {
+					residues.push({ chain: chain.asym_id, ...residue });
+				})
+			})
+		});
+
+		this.setResidues(data, residues);
+	}
+
+	// Same, for the list of residues returned by decodeRamaAngles
+	setResidues(data, residues) {
+
 		this.stats = {
 			orig: {
 				zscore: data.OZRAMA,
@@ -351,39 +367,35 @@ export class RamachandranPlot extends LitElement {
 		// The actual data
 		const dataMap = new Map();
 
-		rama.forEach(entity => {
-			entity.chains.forEach(chain => {
-				chain.models[0].residues.forEach(residue => {
-					const key = `${chain.asym_id}-${residue.seq_id}`;
-					dataMap.set(key, {
-						chain: chain.asym_id,
-						residue_name: residue.compound_id,
-						residue_number: residue.seq_id,
-						key: key,
-						orig: {
-							phi: residue.orig.phi,
-							psi: residue.orig.psi,
-							rama: residue.orig.rama,
-							cis_peptide: residue.orig.cis
-						},
-						redo: {
-							phi: residue.redo.phi,
-							psi: residue.redo.psi,
-							rama: residue.redo.rama,
-							cis_peptide: residue.redo.cis
-						}
-					});
-
-					for (let s of ['orig', 'redo']) {
-						switch (residue[s].rama)
-						{
-							case 'Favored': this.stats[s].preferred += 1; break;
-							case 'Allowed': this.stats[s].allowed += 1; break;
-							case 'OUTLIER': this.stats[s].outliers += 1; break;
-						}
-					}
-				})
-			})
+		residues.forEach(residue => {
+			const key = `${residue.chain}-${residue.seq_id}`;
+			dataMap.set(key, {
+				chain: residue.chain,
+				residue_name: residue.compound_id,
+				residue_number: residue.seq_id,
+				key: key,
+				orig: {
+					phi: residue.orig.phi,
+					psi: residue.orig.psi,
+					rama: residue.orig.rama,
+					cis_peptide: residue.orig.cis
+				},
+				redo: {
+					phi: residue.redo.phi,
+					psi: residue.redo.psi,
+					rama: residue.redo.rama,
+					cis_peptide: residue.redo.cis
+				}
+			});
+
+			for (let s of ['orig', 'redo']) {
+				switch (residue[s].rama)
+				{
+					case 'Favored': this.stats[s].preferred += 1; break;
+					case 'Allowed': this.stats[s].allowed += 1; break;
+					case 'OUTLIER': this.stats[s].outliers += 1; break;
+				}
+			}
 		});
 
 		this.data = [...dataMap.values()];
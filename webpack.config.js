@@ -19,6 +19,7 @@ module.exports = (env) => {
 			index: SCRIPTS + "index.js",
 			'inline-entry': SCRIPTS + 'inline-entry.js',
 			jobs: SCRIPTS + 'jobs.js',
+			'job-log': SCRIPTS + 'job-log.js',
 			'pdb-redo-result': SCRIPTS + 'pdb-redo-result.js',
 			'pdb-redo-result-loader': SCRIPTS + 'pdb-redo-result-loader.js',
 			tokens: SCRIPTS + "tokens.js",